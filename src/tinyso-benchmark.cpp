@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tinyso.hpp"
+
+// Every allocation in the process is counted, so that the allocations made
+// by the optimizer during a generation can be reported. The replacements
+// are kept out of line, since GCC otherwise sees the malloc() and free()
+// inside them and warns that they do not match new and delete.
+std::atomic<uint64_t> allocationCount{0};
+
+__attribute__((noinline)) void *operator new(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  void *p = std::malloc((size > 0) ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t)
+  noexcept {
+  std::free(p);
+}
+
+// CMA-ES keeps and decomposes a full covariance matrix, which is not
+// practical for longer genomes.
+uint32_t const CMAES_MAX_LENGTH = 200;
+
+// The synthetic functions, negated since tinyso maximizes. Genes in [0, 1]
+// are mapped to the usual domain of each function, and all have their
+// optimum, 0, inside it.
+double sphere(tinyso::Individual const &ind) {
+  double f{0.0};
+  for (double const gene : ind) {
+    double const x = 10.0 * gene - 5.0;
+    f += x * x;
+  }
+  return -f;
+}
+
+double rastrigin(tinyso::Individual const &ind) {
+  double const pi = 3.14159265358979323846;
+  double f{10.0 * static_cast<double>(ind.size())};
+  for (double const gene : ind) {
+    double const x = 10.24 * gene - 5.12;
+    f += x * x - 10.0 * std::cos(2.0 * pi * x);
+  }
+  return -f;
+}
+
+double rosenbrock(tinyso::Individual const &ind) {
+  double f{0.0};
+  for (uint32_t i{0}; i + 1 < ind.size(); i++) {
+    double const x = 4.0 * ind[i] - 2.0;
+    double const y = 4.0 * ind[i + 1] - 2.0;
+    f += 100.0 * (y - x * x) * (y - x * x) + (1.0 - x) * (1.0 - x);
+  }
+  return -f;
+}
+
+// Splits a comma separated list of numbers.
+std::vector<uint32_t> parseList(std::string const &list) {
+  std::vector<uint32_t> values;
+  std::istringstream sstr(list);
+  std::string value;
+  while (std::getline(sstr, value, ',')) {
+    if (!value.empty()) {
+      values.push_back(static_cast<uint32_t>(std::stoul(value)));
+    }
+  }
+  return values;
+}
+
+std::vector<std::string> parseNames(std::string const &list,
+    std::vector<std::string> const &all) {
+  if (list == "all") {
+    return all;
+  }
+  std::vector<std::string> names;
+  std::istringstream sstr(list);
+  std::string name;
+  while (std::getline(sstr, name, ',')) {
+    if (!name.empty()) {
+      names.push_back(name);
+    }
+  }
+  return names;
+}
+
+int32_t main(int32_t argc, char **argv) {
+  int32_t retCode{0};
+
+  // Arguments are given as --name=value, and a bare --name as "1".
+  std::map<std::string, std::string> commandlineArguments;
+  bool isValid{true};
+  for (int32_t i{1}; i < argc; i++) {
+    std::string const argument = argv[i];
+    if (argument.compare(0, 2, "--") != 0) {
+      isValid = false;
+      break;
+    }
+    size_t const equals = argument.find('=');
+    if (equals == std::string::npos) {
+      commandlineArguments[argument.substr(2)] = "1";
+    } else {
+      commandlineArguments[argument.substr(2, equals - 2)] =
+        argument.substr(equals + 1);
+    }
+  }
+
+  if (!isValid || commandlineArguments.count("help") != 0) {
+    std::cerr << argv[0]
+      << " measures the overhead of the tinyso optimizers on synthetic"
+      << " fitness functions." << std::endl;
+    std::cerr << "Usage:   " << argv[0]
+      << " [--optimizer=<ga,cmaes,de,pso or all. Default: all>]"
+      << " [--function=<sphere,rastrigin,rosenbrock or all. Default: all>]"
+      << " [--noise=<Standard deviation of noise added to every evaluation."
+      << " Default: 0>]"
+      << " [--length=<Genome lengths. Default: 6,100,1000>]"
+      << " [--population=<Population sizes. Default: 30,300,3000>]"
+      << " [--threads=<Thread counts. Default: 1 and all cores>]"
+      << " [--generations=<Timed generations per run. Default: 20>]"
+      << " [--curve=<File to write the best fitness of every generation to>]"
+      << std::endl;
+    std::cerr << "Example: " << argv[0]
+      << " --optimizer=ga --function=rastrigin --length=6,10000"
+      << " --population=30,10000 --threads=1,4" << std::endl;
+    retCode = 1;
+  } else {
+    auto argument = [&commandlineArguments](std::string const &name,
+        std::string const &value) {
+      return (commandlineArguments.count(name) != 0)
+        ? commandlineArguments[name] : value;
+    };
+
+    uint32_t const cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> const optimizers = parseNames(
+        argument("optimizer", "all"), {"ga", "cmaes", "de", "pso"});
+    std::vector<std::string> const functions = parseNames(
+        argument("function", "all"), {"sphere", "rastrigin", "rosenbrock"});
+    double const noise = std::stod(argument("noise", "0"));
+    std::vector<uint32_t> const lengths = parseList(
+        argument("length", "6,100,1000"));
+    std::vector<uint32_t> const populations = parseList(
+        argument("population", "30,300,3000"));
+    std::vector<uint32_t> const threads = parseList(argument("threads",
+          (cores > 1) ? "1," + std::to_string(cores) : "1"));
+    uint32_t const generationCount = std::stoi(argument("generations", "20"));
+
+    std::ofstream curve;
+    if (commandlineArguments.count("curve") != 0) {
+      curve.open(commandlineArguments["curve"]);
+      curve << "optimizer,function,noise,length,population,threads,generation,"
+        << "evaluations,best_fitness,best_value" << std::endl;
+    }
+
+    std::cout << "optimizer,function,noise,length,population,threads,"
+      << "generations,seconds,generations_per_s,evaluations_per_s,"
+      << "allocations_per_generation,best_fitness,best_value" << std::endl;
+
+    for (std::string const &functionName : functions) {
+      std::function<double(tinyso::Individual const &)> function = sphere;
+      if (functionName == "rastrigin") {
+        function = rastrigin;
+      } else if (functionName == "rosenbrock") {
+        function = rosenbrock;
+      } else if (functionName != "sphere") {
+        std::cerr << "Unknown function '" << functionName << "'." << std::endl;
+        retCode = 1;
+        continue;
+      }
+
+      // The noise is drawn per thread, as the evaluations run in parallel.
+      std::atomic<uint64_t> evaluationCount{0};
+      std::function<double(tinyso::Individual const &, uint32_t const)>
+        evaluate = [&function, &noise, &evaluationCount](
+            tinyso::Individual const &ind, uint32_t const) {
+          evaluationCount.fetch_add(1, std::memory_order_relaxed);
+          double fitness = function(ind);
+          if (noise > 0.0) {
+            thread_local std::mt19937 generator(std::random_device{}());
+            std::normal_distribution<double> dist(0.0, noise);
+            fitness += dist(generator);
+          }
+          return fitness;
+        };
+
+      for (std::string const &optimizerName : optimizers) {
+        if (optimizerName != "ga" && optimizerName != "cmaes"
+            && optimizerName != "de" && optimizerName != "pso") {
+          std::cerr << "Unknown optimizer '" << optimizerName << "'."
+            << std::endl;
+          retCode = 1;
+          continue;
+        }
+        for (uint32_t const length : lengths) {
+          if (optimizerName == "cmaes" && length > CMAES_MAX_LENGTH) {
+            std::cerr << "Skipping cmaes with length " << length << " (at most "
+              << CMAES_MAX_LENGTH << ")." << std::endl;
+            continue;
+          }
+          for (uint32_t const population : populations) {
+            for (uint32_t const threadCount : threads) {
+              std::unique_ptr<tinyso::Optimizer> optimizer;
+              if (optimizerName == "ga") {
+                optimizer.reset(new tinyso::GeneticAlgorithm(evaluate,
+                      tinyso::CrossoverMethod::Split, length, 1, population, 2,
+                      0.3f, 0.1f, 0.8f));
+              } else if (optimizerName == "cmaes") {
+                optimizer.reset(new tinyso::CmaEs(evaluate, length,
+                      population));
+              } else if (optimizerName == "de") {
+                optimizer.reset(new tinyso::DifferentialEvolution(evaluate,
+                      length, population));
+              } else {
+                optimizer.reset(new tinyso::ParticleSwarm(evaluate, length,
+                      population));
+              }
+              optimizer->SetRandomSeed(1);
+
+              // The first generation sets up the population and the worker
+              // threads, and is not timed.
+              optimizer->NextGeneration(threadCount);
+              // The curve is kept in memory reserved up front and written
+              // once the timing is done. With noise the best fitness is the
+              // luckiest sample seen, so the best individual of every
+              // generation is kept as well, to be scored without noise.
+              std::vector<uint64_t> curveEvaluations;
+              std::vector<double> curveFitnesses;
+              std::vector<double> curveGenomes;
+              if (curve.is_open()) {
+                curveEvaluations.reserve(generationCount);
+                curveFitnesses.reserve(generationCount);
+                curveGenomes.reserve(generationCount * length);
+              }
+              evaluationCount.store(0);
+              uint64_t const allocationsBefore = allocationCount.load();
+              auto const start = std::chrono::steady_clock::now();
+              for (uint32_t i{0}; i < generationCount; i++) {
+                optimizer->NextGeneration(threadCount);
+                if (curve.is_open()) {
+                  curveEvaluations.push_back(evaluationCount.load());
+                  curveFitnesses.push_back(optimizer->GetBestFitness());
+                  tinyso::Individual const &best =
+                    optimizer->GetBestIndividual();
+                  curveGenomes.insert(curveGenomes.end(), best.begin(),
+                      best.end());
+                }
+              }
+              double const seconds = std::chrono::duration<double>(
+                  std::chrono::steady_clock::now() - start).count();
+              uint64_t const allocations = allocationCount.load()
+                - allocationsBefore;
+
+              for (uint32_t i{0}; i < curveFitnesses.size(); i++) {
+                tinyso::Individual const best(curveGenomes.begin() + i * length,
+                    curveGenomes.begin() + (i + 1) * length);
+                curve << optimizerName << "," << functionName << "," << noise
+                  << "," << length << "," << optimizer->GetPopulationSize()
+                  << "," << threadCount << "," << i + 1 << ","
+                  << curveEvaluations[i] << "," << curveFitnesses[i] << ","
+                  << function(best) << "\n";
+              }
+
+              std::cout << optimizerName << "," << functionName << "," << noise
+                << "," << length << "," << optimizer->GetPopulationSize() << ","
+                << threadCount << "," << generationCount << "," << seconds
+                << "," << generationCount / seconds << ","
+                << static_cast<double>(evaluationCount.load()) / seconds << ","
+                << static_cast<double>(allocations) / generationCount << ","
+                << optimizer->GetBestFitness() << ","
+                << function(optimizer->GetBestIndividual()) << std::endl;
+            }
+          }
+        }
+      }
+    }
+  }
+  return retCode;
+}
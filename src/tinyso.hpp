@@ -26,11 +26,24 @@
 #define TINYSOA_HPP
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
 #include <ctime>
+#include <fstream>
+#include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -45,356 +58,2551 @@ enum class CrossoverMethod {
   Split
 };
 
-class GeneticAlgorithm {
+// How cached fitness values are reused. Exact assumes a deterministic
+// evaluation and keys on the genome and the evaluation seed. For noisy
+// evaluations, keyed on the genome only, Freeze averages the first samples
+// and then stops evaluating, while Average always evaluates and reports the
+// mean of every sample so far.
+enum class CachePolicy {
+  Exact,
+  Freeze,
+  Average
+};
+
+// A copy of the state a steady-state generation ended with, taken under the
+// lock so that the generation callback can read it while the workers carry
+// on.
+struct SteadyStateGeneration {
+  uint32_t generation_index{0};
+  Population population{};
+  Fitnesses fitnesses{};
+  Individual best_individual{};
+  double best_fitness{0.0};
+};
+
+char const CHECKPOINT_MAGIC[8] = {'T', 'I', 'N', 'Y', 'S', 'O', 'C', 'P'};
+uint32_t const CHECKPOINT_VERSION = 2;
+
+// The genomes of a population in one block of memory, one row per
+// individual. Rows start on 64 byte boundaries so that neighbouring rows do
+// not share cache lines.
+class GenomeMatrix {
   public:
-    GeneticAlgorithm(std::function<double(Individual const &, uint32_t const)>,
-        CrossoverMethod const, uint32_t const, uint32_t const, uint32_t const, 
-        uint32_t const, float const, float const, float const);
-    virtual ~GeneticAlgorithm();
+    GenomeMatrix(uint32_t const, uint32_t const);
+    virtual ~GenomeMatrix();
+    uint32_t GetLength() const;
+    uint32_t GetRowCount() const;
+    double *Row(uint32_t const);
+    double const *Row(uint32_t const) const;
+
+  private:
+    GenomeMatrix(GenomeMatrix const &);
+    GenomeMatrix &operator=(GenomeMatrix const &);
+
+    std::vector<double> m_data;
+    double *m_base;
+    uint32_t const m_length;
+    uint32_t const m_row_count;
+    uint32_t const m_stride;
+};
+
+namespace {
+uint32_t const GENOME_ALIGNMENT = 64 / sizeof(double);
+}
+
+inline GenomeMatrix::GenomeMatrix(uint32_t const row_count,
+    uint32_t const length):
+  m_data(),
+  m_base(nullptr),
+  m_length(length),
+  m_row_count(row_count),
+  m_stride((length + GENOME_ALIGNMENT - 1) / GENOME_ALIGNMENT 
+      * GENOME_ALIGNMENT)
+{
+  m_data.assign(static_cast<size_t>(m_row_count) * m_stride 
+      + GENOME_ALIGNMENT, 0.0);
+  uintptr_t const address = reinterpret_cast<uintptr_t>(m_data.data());
+  uintptr_t const alignment = GENOME_ALIGNMENT * sizeof(double);
+  m_base = reinterpret_cast<double *>((address + alignment - 1) 
+      / alignment * alignment);
+}
+
+inline GenomeMatrix::~GenomeMatrix()
+{
+}
+
+inline uint32_t GenomeMatrix::GetLength() const
+{
+  return m_length;
+}
+
+inline uint32_t GenomeMatrix::GetRowCount() const
+{
+  return m_row_count;
+}
+
+inline double *GenomeMatrix::Row(uint32_t const i)
+{
+  return m_base + static_cast<size_t>(i) * m_stride;
+}
+
+inline double const *GenomeMatrix::Row(uint32_t const i) const
+{
+  return m_base + static_cast<size_t>(i) * m_stride;
+}
+
+// Threads kept for the lifetime of their owner. Run() hands one task to the
+// given number of them, starting more threads if needed, and returns when
+// every one of them has finished it.
+class WorkerPool {
+  public:
+    WorkerPool();
+    virtual ~WorkerPool();
+    void Run(uint32_t const, std::function<void()> const &);
+
+  private:
+    WorkerPool(WorkerPool const &);
+    WorkerPool &operator=(WorkerPool const &);
+    void Work(uint32_t const);
+
+    std::mutex m_mutex;
+    std::condition_variable m_task_added;
+    std::condition_variable m_task_done;
+    std::vector<std::thread> m_threads;
+    std::function<void()> const *m_task;
+    uint64_t m_round;
+    uint32_t m_active;
+    uint32_t m_remaining;
+    bool m_stop;
+};
+
+inline WorkerPool::WorkerPool():
+  m_mutex(),
+  m_task_added(),
+  m_task_done(),
+  m_threads(),
+  m_task(nullptr),
+  m_round(0),
+  m_active(0),
+  m_remaining(0),
+  m_stop(false)
+{
+}
+
+inline WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_task_added.notify_all();
+  for (auto &t : m_threads) {
+    t.join();
+  }
+}
+
+inline void WorkerPool::Run(uint32_t const count,
+    std::function<void()> const &task)
+{
+  if (count == 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (m_threads.size() < count) {
+    m_threads.push_back(std::thread(&WorkerPool::Work, this,
+          static_cast<uint32_t>(m_threads.size())));
+  }
+  m_task = &task;
+  m_active = count;
+  m_remaining = count;
+  m_round++;
+  m_task_added.notify_all();
+  m_task_done.wait(lock, [this]() { return m_remaining == 0; });
+  m_task = nullptr;
+}
+
+// Threads beyond the count asked for sit out the round.
+inline void WorkerPool::Work(uint32_t const id)
+{
+  uint64_t round{0};
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_task_added.wait(lock, [this, &round]() {
+        return m_stop || m_round != round;
+      });
+    if (m_stop) {
+      break;
+    }
+    round = m_round;
+    if (id >= m_active) {
+      continue;
+    }
+
+    std::function<void()> const &task = *m_task;
+    lock.unlock();
+    task();
+    lock.lock();
+    if (--m_remaining == 0) {
+      m_task_done.notify_one();
+    }
+  }
+}
+
+// A radial basis function model of the fitness, fitted to the most recent
+// capacity evaluated genomes. Samples are added one at a time into a ring
+// buffer and the model is refitted lazily, at the first prediction after a
+// change. Fitting solves a regularized Gaussian kernel system by Cholesky
+// decomposition, O(capacity^3), and a prediction costs O(capacity * length).
+// The kernel width is the root mean square distance between the samples.
+class RbfSurrogate {
+  public:
+    RbfSurrogate(uint32_t const, uint32_t const);
+    virtual ~RbfSurrogate();
+    void Add(double const *, double const);
+    uint32_t GetSampleCount() const;
+    double Predict(double const *, double * = nullptr);
+    bool ReadState(std::string const &);
+    std::string WriteState() const;
+
+  private:
+    RbfSurrogate(RbfSurrogate const &);
+    RbfSurrogate &operator=(RbfSurrogate const &);
+    void Fit();
+    double GetSquaredDistance(double const *, double const *) const;
+
+    GenomeMatrix m_samples;
+    Fitnesses m_fitnesses;
+    std::vector<double> m_cholesky;
+    std::vector<double> m_kernel;
+    std::vector<double> m_weights;
+    double m_deviation;
+    double m_mean;
+    double m_width_squared;
+    uint32_t m_count;
+    uint32_t m_next;
+    uint32_t const m_length;
+    bool m_fitted;
+};
+
+namespace {
+// Added to the diagonal of the kernel matrix. It smooths noisy fitnesses and
+// keeps the system well conditioned when samples lie close together.
+double const SURROGATE_RIDGE = 1e-2;
+// Standard deviations of the prediction added to it when offspring are
+// ranked, which favours candidates unlike those already evaluated.
+double const SURROGATE_EXPLORATION = 2.0;
+}
+
+inline RbfSurrogate::RbfSurrogate(uint32_t const length,
+    uint32_t const capacity):
+  m_samples(std::max(1u, capacity), length),
+  m_fitnesses(std::max(1u, capacity), 0.0),
+  m_cholesky(),
+  m_kernel(),
+  m_weights(),
+  m_deviation(0.0),
+  m_mean(0.0),
+  m_width_squared(1.0),
+  m_count(0),
+  m_next(0),
+  m_length(length),
+  m_fitted(false)
+{
+}
+
+inline RbfSurrogate::~RbfSurrogate()
+{
+}
+
+// Replaces the oldest sample once the capacity is reached.
+inline void RbfSurrogate::Add(double const *genome, double const fitness)
+{
+  std::copy(genome, genome + m_length, m_samples.Row(m_next));
+  m_fitnesses[m_next] = fitness;
+  m_next = (m_next + 1) % m_samples.GetRowCount();
+  m_count = std::min(m_count + 1, m_samples.GetRowCount());
+  m_fitted = false;
+}
+
+inline void RbfSurrogate::Fit()
+{
+  uint32_t const n = m_count;
+  m_mean = 0.0;
+  for (uint32_t i{0}; i < n; i++) {
+    m_mean += m_fitnesses[i];
+  }
+  m_mean /= n;
+  m_deviation = 0.0;
+  for (uint32_t i{0}; i < n; i++) {
+    m_deviation += (m_fitnesses[i] - m_mean) * (m_fitnesses[i] - m_mean);
+  }
+  m_deviation = std::sqrt(m_deviation / n);
+
+  std::vector<double> &k = m_cholesky;
+  k.assign(n * n, 0.0);
+  double distance_sum{0.0};
+  for (uint32_t i{0}; i < n; i++) {
+    for (uint32_t j{0}; j < i; j++) {
+      double const d = GetSquaredDistance(m_samples.Row(i), m_samples.Row(j));
+      k[i * n + j] = d;
+      distance_sum += d;
+    }
+  }
+  m_width_squared = (n > 1 && distance_sum > 0.0) 
+    ? distance_sum / (0.5 * n * (n - 1)) : 1.0;
+
+  // K = L * L^T, stored in the lower triangle.
+  for (uint32_t i{0}; i < n; i++) {
+    for (uint32_t j{0}; j < i; j++) {
+      k[i * n + j] = std::exp(-k[i * n + j] / m_width_squared);
+    }
+    k[i * n + i] = 1.0 + SURROGATE_RIDGE;
+  }
+  for (uint32_t j{0}; j < n; j++) {
+    double diagonal = k[j * n + j];
+    for (uint32_t p{0}; p < j; p++) {
+      diagonal -= k[j * n + p] * k[j * n + p];
+    }
+    diagonal = std::sqrt(std::max(diagonal, 1e-12));
+    k[j * n + j] = diagonal;
+    for (uint32_t i{j + 1}; i < n; i++) {
+      double value = k[i * n + j];
+      for (uint32_t p{0}; p < j; p++) {
+        value -= k[i * n + p] * k[j * n + p];
+      }
+      k[i * n + j] = value / diagonal;
+    }
+  }
+
+  m_weights.assign(n, 0.0);
+  for (uint32_t i{0}; i < n; i++) {
+    double value = m_fitnesses[i] - m_mean;
+    for (uint32_t p{0}; p < i; p++) {
+      value -= k[i * n + p] * m_weights[p];
+    }
+    m_weights[i] = value / k[i * n + i];
+  }
+  for (uint32_t i{n}; i > 0; i--) {
+    double value = m_weights[i - 1];
+    for (uint32_t p{i}; p < n; p++) {
+      value -= k[p * n + i - 1] * m_weights[p];
+    }
+    m_weights[i - 1] = value / k[(i - 1) * n + i - 1];
+  }
+  m_fitted = true;
+}
+
+inline uint32_t RbfSurrogate::GetSampleCount() const
+{
+  return m_count;
+}
+
+inline double RbfSurrogate::GetSquaredDistance(double const *a,
+    double const *b) const
+{
+  double d{0.0};
+  for (uint32_t i{0}; i < m_length; i++) {
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return d;
+}
+
+// The predicted fitness, which is the mean fitness far from every sample.
+// The model is the posterior mean of a Gaussian process with the same
+// kernel, and its posterior standard deviation, in fitness units, is given
+// if asked for. It grows from about zero at the samples to the standard
+// deviation of the sampled fitnesses far from them.
+inline double RbfSurrogate::Predict(double const *genome, double *deviation)
+{
+  uint32_t const n = m_count;
+  if (n == 0) {
+    if (deviation != nullptr) {
+      *deviation = 0.0;
+    }
+    return 0.0;
+  }
+  if (!m_fitted) {
+    Fit();
+  }
+
+  std::vector<double> &kernel = m_kernel;
+  kernel.resize(n);
+  double prediction{m_mean};
+  for (uint32_t i{0}; i < n; i++) {
+    kernel[i] = std::exp(-GetSquaredDistance(genome, m_samples.Row(i)) 
+        / m_width_squared);
+    prediction += m_weights[i] * kernel[i];
+  }
+
+  if (deviation != nullptr) {
+    // 1 - k^T K^-1 k = 1 - |L^-1 k|^2.
+    double explained{0.0};
+    for (uint32_t i{0}; i < n; i++) {
+      double value = kernel[i];
+      for (uint32_t p{0}; p < i; p++) {
+        value -= m_cholesky[i * n + p] * kernel[p];
+      }
+      kernel[i] = value / m_cholesky[i * n + i];
+      explained += kernel[i] * kernel[i];
+    }
+    *deviation = m_deviation * std::sqrt(std::max(0.0, 1.0 - explained));
+  }
+  return prediction;
+}
+
+// The samples, in the order they are stored. Returns false, leaving the
+// model untouched, if the state does not match the capacity and length.
+inline bool RbfSurrogate::ReadState(std::string const &state)
+{
+  std::istringstream in(state);
+  uint32_t count{0};
+  uint32_t next{0};
+  uint32_t length{0};
+  in.read(reinterpret_cast<char *>(&count), sizeof(count));
+  in.read(reinterpret_cast<char *>(&next), sizeof(next));
+  in.read(reinterpret_cast<char *>(&length), sizeof(length));
+  uint32_t const capacity = m_samples.GetRowCount();
+  if (!in || count > capacity || next >= capacity || length != m_length) {
+    return false;
+  }
+
+  Population samples(count, Individual(length));
+  Fitnesses fitnesses(count);
+  for (uint32_t i{0}; i < count; i++) {
+    in.read(reinterpret_cast<char *>(samples[i].data()), 
+        length * sizeof(double));
+    in.read(reinterpret_cast<char *>(&fitnesses[i]), sizeof(double));
+  }
+  if (!in) {
+    return false;
+  }
+
+  for (uint32_t i{0}; i < count; i++) {
+    std::copy(samples[i].begin(), samples[i].end(), m_samples.Row(i));
+    m_fitnesses[i] = fitnesses[i];
+  }
+  m_count = count;
+  m_next = next;
+  m_fitted = false;
+  return true;
+}
+
+inline std::string RbfSurrogate::WriteState() const
+{
+  std::ostringstream out;
+  out.write(reinterpret_cast<char const *>(&m_count), sizeof(m_count));
+  out.write(reinterpret_cast<char const *>(&m_next), sizeof(m_next));
+  out.write(reinterpret_cast<char const *>(&m_length), sizeof(m_length));
+  for (uint32_t i{0}; i < m_count; i++) {
+    out.write(reinterpret_cast<char const *>(m_samples.Row(i)),
+        m_length * sizeof(double));
+    out.write(reinterpret_cast<char const *>(&m_fitnesses[i]), 
+        sizeof(double));
+  }
+  return out.str();
+}
+
+// The interface shared by the optimizers, in ask/tell form. Ask() puts a new
+// population of candidates in place (see GetGenome and GetPopulation), and
+// Tell() hands back their fitnesses so that the optimizer can update its
+// search. NextGeneration() does both, evaluating the candidates in between
+// on a pool of worker threads. The base class also keeps the best
+// individual found so far, and reads and writes checkpoints in one format
+// for all optimizers, each adding its own state to it.
+class Optimizer {
+  public:
+    Optimizer(std::function<double(Individual const &, uint32_t const)>,
+        uint32_t const, uint32_t const);
+    virtual ~Optimizer();
+    void Ask();
     double GetBestFitness() const;
-    Individual GetBestIndividual() const;
+    Individual const &GetBestIndividual() const;
+    Fitnesses GetFitnessVariances() const;
+    Fitnesses GetFitnesses() const;
     int32_t GetGenerationIndex() const;
-    void NextGeneration(uint32_t const);
+    double const *GetGenome(uint32_t const) const;
+    uint32_t GetIndividualLength() const;
+    virtual std::string GetName() const = 0;
     Population GetPopulation() const;
-    Fitnesses GetFitnesses() const;
-    void SetCrossoverIndividuals(
-        std::function<std::pair<Individual, Individual>(Individual const &,
-          Individual const &)>);
-    void SetMutateIndividual(std::function<Individual(Individual const &)>);
+    uint32_t GetPopulationSize() const;
+    bool LoadCheckpoint(std::string const &, std::string &);
+    void NextGeneration(uint32_t const);
+    bool SaveCheckpoint(std::string const &, std::string const & = "") const;
+    void SetCheckpoint(std::string const &, uint32_t const,
+        std::function<std::string()> = nullptr);
+    void SetRandomSeed(uint32_t const);
+    void Tell(Fitnesses const &);
+
+  protected:
+    static double Fold(double);
+    static bool Read(std::istream &, void *, size_t);
+    static bool ReadString(std::istream &, std::string &);
+    static void Write(std::ostream &, void const *, size_t);
+    static bool WriteCheckpointFile(std::string const &,
+        std::string const &);
+    static void WriteString(std::ostream &, std::string const &);
+    virtual Fitnesses Evaluate(uint32_t const);
+    virtual double EvaluateIndividual(Individual const &, uint32_t const);
+    Fitnesses EvaluateRows(std::vector<uint32_t> const &, uint32_t const);
+    uint32_t GetRandomInteger(uint32_t, uint32_t);
+    double GetRandomCreep();
+    double GetRandomDouble();
+    float GetRandomFloat();
+    double GetRandomNormal();
+    virtual void Initialize() = 0;
+    virtual void Propose() = 0;
+    virtual bool ReadState(std::string const &) = 0;
+    void SetSeededEvaluation(uint32_t const, std::function<double(
+          Individual const &, uint32_t const, uint64_t const)>);
+    virtual void Update() = 0;
+    std::string GetCheckpoint(std::string const &) const;
+    bool GetCheckpointIfDue(uint32_t const, std::string &) const;
+    void UpdateBest();
+    void WriteCheckpoint(std::string const &) const;
+    void WriteCheckpointIfDue();
+    virtual std::string WriteState() const = 0;
+
+    std::default_random_engine m_generator;
+    std::function<double(Individual const &, uint32_t const)> 
+      m_evaluate_individual;
+    std::function<double(Individual const &, uint32_t const, uint64_t const)>
+      m_evaluate_seeded;
+    WorkerPool m_workers;
+    GenomeMatrix m_genomes_a;
+    GenomeMatrix m_genomes_b;
+    Fitnesses m_fitness_variances;
+    Fitnesses m_fitnesses;
+    Individual m_best_individual;
+    std::vector<uint64_t> m_evaluation_seeds;
+    // The candidates asked for. The second matrix is the optimizer's own.
+    GenomeMatrix *m_population;
+    GenomeMatrix *m_population_next;
+    double m_best_fitness;
+    uint32_t m_generation_index;
+    uint32_t const m_individual_length;
+    uint32_t const m_population_size;
+
+  private:
+    Optimizer(Optimizer const &);
+    Optimizer &operator=(Optimizer const &);
+
+    std::function<std::string()> m_checkpoint_data;
+    std::string m_checkpoint_filename;
+    uint32_t m_checkpoint_interval;
+};
+
+inline Optimizer::Optimizer(
+    std::function<double(Individual const &, uint32_t const)> evaluate_individual,
+    uint32_t const individual_length, uint32_t const population_size):
+  m_generator(time(0)),
+  m_evaluate_individual(evaluate_individual),
+  m_evaluate_seeded(nullptr),
+  m_workers(),
+  m_genomes_a(population_size, individual_length),
+  m_genomes_b(population_size, individual_length),
+  m_fitness_variances(),
+  m_fitnesses(),
+  m_best_individual(),
+  m_evaluation_seeds(),
+  m_population(&m_genomes_a),
+  m_population_next(&m_genomes_b),
+  m_best_fitness(std::numeric_limits<double>::lowest()),
+  m_generation_index(0),
+  m_individual_length(individual_length),
+  m_population_size(population_size),
+  m_checkpoint_data(nullptr),
+  m_checkpoint_filename(),
+  m_checkpoint_interval(0)
+{
+}
+
+inline Optimizer::~Optimizer()
+{
+}
+
+// Starts the next generation and puts its candidates in place.
+inline void Optimizer::Ask()
+{
+  m_generation_index++;
+  if (m_evaluate_seeded != nullptr) {
+    std::uniform_int_distribution<uint32_t> seed_distribution;
+    for (uint64_t &seed : m_evaluation_seeds) {
+      seed = seed_distribution(m_generator);
+    }
+  }
+  Propose();
+}
+
+// Evaluates every candidate on its own, in parallel.
+inline Fitnesses Optimizer::Evaluate(uint32_t const cores)
+{
+  std::vector<uint32_t> rows(m_population_size);
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    rows[i] = i;
+  }
+  return EvaluateRows(rows, cores);
+}
+
+inline double Optimizer::EvaluateIndividual(Individual const &individual,
+    uint32_t const index)
+{
+  return m_evaluate_individual(individual, index);
+}
+
+// Evaluates the given rows of the population one by one, or, with seeded
+// evaluation, every row once per seed. Workers take the next evaluation from
+// a shared counter, so the episodes of one row are spread over idle workers,
+// copy its genome into their own reused Individual and write only their own
+// result slots. The fitness of a row is then the mean over the seeds.
+inline Fitnesses Optimizer::EvaluateRows(std::vector<uint32_t> const &rows,
+    uint32_t const cores)
+{
+  bool const seeded = (m_evaluate_seeded != nullptr);
+  uint32_t const row_count = rows.size();
+  uint32_t const seed_count = seeded ? m_evaluation_seeds.size() : 1;
+  uint32_t const task_count = row_count * seed_count;
+  Fitnesses samples(task_count);
+  std::atomic<uint32_t> next_index{0};
+
+  std::function<void()> const worker{[this, &rows, &samples, &next_index,
+    seeded, seed_count, task_count]() {
+    Individual individual(m_individual_length);
+    uint32_t copied_row{UINT32_MAX};
+    while (true) {
+      uint32_t const index = next_index.fetch_add(1,
+          std::memory_order_relaxed);
+      if (index >= task_count) {
+        break;
+      }
+      uint32_t const row = rows[index / seed_count];
+      if (row != copied_row) {
+        double const *genome = m_population->Row(row);
+        std::copy(genome, genome + m_individual_length, individual.begin());
+        copied_row = row;
+      }
+      samples[index] = seeded 
+        ? m_evaluate_seeded(individual, row, 
+            m_evaluation_seeds[index % seed_count])
+        : EvaluateIndividual(individual, row);
+    }
+  }};
+
+  m_workers.Run(cores, worker);
+  if (!seeded) {
+    return samples;
+  }
+
+  Fitnesses fitnesses(row_count);
+  m_fitness_variances.assign(m_population_size, 
+      std::numeric_limits<double>::quiet_NaN());
+  for (uint32_t i{0}; i < row_count; i++) {
+    double const *sample = samples.data() + i * seed_count;
+    double mean{0.0};
+    for (uint32_t k{0}; k < seed_count; k++) {
+      mean += sample[k];
+    }
+    mean /= seed_count;
+    double variance{0.0};
+    for (uint32_t k{0}; k < seed_count; k++) {
+      variance += (sample[k] - mean) * (sample[k] - mean);
+    }
+    fitnesses[i] = mean;
+    m_fitness_variances[rows[i]] = (seed_count > 1) 
+      ? variance / (seed_count - 1) : 0.0;
+  }
+  return fitnesses;
+}
+
+// Folds a gene back into [0, 1] by reflecting it at the bounds.
+inline double Optimizer::Fold(double x)
+{
+  x = std::fmod(std::fabs(x), 2.0);
+  return (x > 1.0) ? 2.0 - x : x;
+}
+
+inline double Optimizer::GetBestFitness() const
+{
+  return m_best_fitness;
+}
+
+inline Individual const &Optimizer::GetBestIndividual() const
+{
+  return m_best_individual;
+}
+
+// The contents of a checkpoint file, see SaveCheckpoint.
+inline std::string Optimizer::GetCheckpoint(std::string const &user_data)
+  const
+{
+  std::ostringstream out;
+  std::ostringstream generator_stream;
+  generator_stream << m_generator;
+
+  uint32_t const best_length = m_best_individual.size();
+  uint32_t const fitness_count = m_fitnesses.size();
+
+  Write(out, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  Write(out, &CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION));
+  WriteString(out, GetName());
+  Write(out, &m_generation_index, sizeof(m_generation_index));
+  Write(out, &m_population_size, sizeof(m_population_size));
+  Write(out, &m_individual_length, sizeof(m_individual_length));
+  Write(out, &m_best_fitness, sizeof(m_best_fitness));
+  WriteString(out, generator_stream.str());
+  Write(out, &best_length, sizeof(best_length));
+  Write(out, m_best_individual.data(), best_length * sizeof(double));
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    Write(out, m_population->Row(i), m_individual_length * sizeof(double));
+  }
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    Write(out, m_population_next->Row(i), 
+        m_individual_length * sizeof(double));
+  }
+  Write(out, &fitness_count, sizeof(fitness_count));
+  Write(out, m_fitnesses.data(), fitness_count * sizeof(double));
+  WriteString(out, WriteState());
+  WriteString(out, user_data);
+  return out.str();
+}
+
+// With seeded evaluation, the sample variance over the seeds of each
+// candidate of the last generation, NaN where it was not evaluated.
+// Gives the contents of a checkpoint, with the user data, if one is due at
+// the given generation.
+inline bool Optimizer::GetCheckpointIfDue(uint32_t const generation_index,
+    std::string &contents) const
+{
+  if (m_checkpoint_interval == 0 
+      || generation_index % m_checkpoint_interval != 0) {
+    return false;
+  }
+  contents = GetCheckpoint((m_checkpoint_data != nullptr) 
+      ? m_checkpoint_data() : "");
+  return true;
+}
+
+inline Fitnesses Optimizer::GetFitnessVariances() const
+{
+  return m_fitness_variances;
+}
+
+inline Fitnesses Optimizer::GetFitnesses() const
+{
+  return m_fitnesses;
+}
+
+inline int32_t Optimizer::GetGenerationIndex() const
+{
+  return m_generation_index;
+}
+
+// The genome of the given candidate, valid until the next generation.
+inline double const *Optimizer::GetGenome(uint32_t const index) const
+{
+  return m_population->Row(index);
+}
+
+inline uint32_t Optimizer::GetIndividualLength() const
+{
+  return m_individual_length;
+}
+
+// A copy of the candidates, see GetGenome for access without copying.
+inline Population Optimizer::GetPopulation() const
+{
+  Population population;
+  population.reserve(m_population_size);
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    double const *genome = m_population->Row(i);
+    population.emplace_back(genome, genome + m_individual_length);
+  }
+  return population;
+}
+
+inline uint32_t Optimizer::GetPopulationSize() const
+{
+  return m_population_size;
+}
+
+inline uint32_t Optimizer::GetRandomInteger(uint32_t min, uint32_t max)
+{
+  std::uniform_int_distribution<uint32_t> int_distribution(min, max);
+  return int_distribution(m_generator);
+}
+
+inline double Optimizer::GetRandomCreep()
+{
+  std::normal_distribution<double> normal_distribution(0.0, 0.1);
+  return normal_distribution(m_generator);
+}
+
+inline double Optimizer::GetRandomDouble()
+{
+  std::uniform_real_distribution<double> uniform_distribution(0.0, 1.0);
+  return uniform_distribution(m_generator);
+}
+
+inline float Optimizer::GetRandomFloat()
+{
+  std::uniform_real_distribution<float> uniform_distribution(0.0, 1.0);
+  return uniform_distribution(m_generator);
+}
+
+inline double Optimizer::GetRandomNormal()
+{
+  std::normal_distribution<double> normal_distribution(0.0, 1.0);
+  return normal_distribution(m_generator);
+}
+
+// Restores a state written by SaveCheckpoint, including the random number
+// generator, so that the run continues exactly as it would have. The
+// checkpoint must come from the same kind of optimizer, with the same
+// population size and individual length. Returns false, leaving the state
+// untouched, if it cannot be read.
+inline bool Optimizer::LoadCheckpoint(std::string const &filename,
+    std::string &user_data)
+{
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  uint32_t version{0};
+  std::string name;
+  Read(file, magic, sizeof(magic));
+  Read(file, &version, sizeof(version));
+  ReadString(file, name);
+  if (!file || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0
+      || version != CHECKPOINT_VERSION || name != GetName()) {
+    return false;
+  }
+
+  uint32_t generation_index{0};
+  uint32_t population_size{0};
+  uint32_t individual_length{0};
+  double best_fitness{0.0};
+  Read(file, &generation_index, sizeof(generation_index));
+  Read(file, &population_size, sizeof(population_size));
+  Read(file, &individual_length, sizeof(individual_length));
+  Read(file, &best_fitness, sizeof(best_fitness));
+  if (!file || population_size != m_population_size
+      || individual_length != m_individual_length) {
+    return false;
+  }
+
+  std::string generator_state;
+  ReadString(file, generator_state);
+
+  uint32_t best_length{0};
+  Read(file, &best_length, sizeof(best_length));
+  if (!file || best_length > individual_length) {
+    return false;
+  }
+  Individual best_individual(best_length);
+  Read(file, best_individual.data(), best_length * sizeof(double));
+
+  Population population(population_size, Individual(individual_length));
+  Population population_next(population_size, Individual(individual_length));
+  for (auto &individual : population) {
+    Read(file, individual.data(), individual_length * sizeof(double));
+  }
+  for (auto &individual : population_next) {
+    Read(file, individual.data(), individual_length * sizeof(double));
+  }
+  uint32_t fitness_count{0};
+  Read(file, &fitness_count, sizeof(fitness_count));
+  if (!file || fitness_count > population_size) {
+    return false;
+  }
+  Fitnesses fitnesses(fitness_count);
+  Read(file, fitnesses.data(), fitness_count * sizeof(double));
+
+  std::string state;
+  std::string data;
+  ReadString(file, state);
+  ReadString(file, data);
+  if (!file) {
+    return false;
+  }
+
+  std::istringstream generator_stream(generator_state);
+  std::default_random_engine generator;
+  generator_stream >> generator;
+  if (generator_stream.fail() || !ReadState(state)) {
+    return false;
+  }
+
+  m_generator = generator;
+  m_generation_index = generation_index;
+  m_best_fitness = best_fitness;
+  m_best_individual = best_individual;
+  for (uint32_t i{0}; i < population_size; i++) {
+    std::copy(population[i].begin(), population[i].end(),
+        m_population->Row(i));
+    std::copy(population_next[i].begin(), population_next[i].end(),
+        m_population_next->Row(i));
+  }
+  m_fitnesses = fitnesses;
+  user_data = data;
+  return true;
+}
+
+inline void Optimizer::NextGeneration(uint32_t const cores)
+{
+  Ask();
+  Tell(Evaluate(cores));
+}
+
+inline bool Optimizer::Read(std::istream &in, void *data, size_t size)
+{
+  in.read(static_cast<char *>(data), size);
+  return static_cast<bool>(in);
+}
+
+inline bool Optimizer::ReadString(std::istream &in, std::string &value)
+{
+  uint64_t size{0};
+  if (!Read(in, &size, sizeof(size)) || size > (1u << 30)) {
+    in.setstate(std::ios::failbit);
+    return false;
+  }
+  value.resize(size);
+  return Read(in, &value[0], size);
+}
+
+// Writes everything needed to continue the run: both genome matrices, the
+// last fitnesses, the best individual, the state of the random number
+// generator and the optimizer's own state, together with user data (e.g.
+// the caller's own generator). The file is written next to the target and
+// then renamed over it, so an interruption never leaves a partial checkpoint.
+inline bool Optimizer::SaveCheckpoint(std::string const &filename,
+    std::string const &user_data) const
+{
+  return WriteCheckpointFile(filename, GetCheckpoint(user_data));
+}
+
+// Takes the fitnesses of the candidates from the last Ask().
+inline void Optimizer::Tell(Fitnesses const &fitnesses)
+{
+  m_fitnesses = fitnesses;
+  Update();
+  WriteCheckpointIfDue();
+}
+
+// Keeps the fittest candidate if it beats the best so far.
+inline void Optimizer::UpdateBest()
+{
+  uint32_t i_highest{0};
+  double highest_fitness{std::numeric_limits<double>::lowest()};
+  for (uint32_t i{0}; i < m_fitnesses.size(); i++) {
+    if (!std::isnan(m_fitnesses[i]) && m_fitnesses[i] > highest_fitness) {
+      i_highest = i;
+      highest_fitness = m_fitnesses[i];
+    }
+  }
+
+  if (highest_fitness > m_best_fitness) {
+    m_best_fitness = highest_fitness;
+    double const *genome = m_population->Row(i_highest);
+    m_best_individual.assign(genome, genome + m_individual_length);
+  }
+}
+
+inline void Optimizer::Write(std::ostream &out, void const *data,
+    size_t size)
+{
+  out.write(static_cast<char const *>(data), size);
+}
+
+// Writes the contents next to the file and renames them over it.
+inline bool Optimizer::WriteCheckpointFile(std::string const &filename,
+    std::string const &contents)
+{
+  std::string const temporary_filename = filename + ".tmp";
+  {
+    std::ofstream file(temporary_filename,
+        std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+    Write(file, contents.data(), contents.size());
+    file.flush();
+    if (!file) {
+      return false;
+    }
+  }
+  return std::rename(temporary_filename.c_str(), filename.c_str()) == 0;
+}
+
+// Writes checkpoint contents to the file given to SetCheckpoint.
+inline void Optimizer::WriteCheckpoint(std::string const &contents) const
+{
+  if (!WriteCheckpointFile(m_checkpoint_filename, contents)) {
+    std::cerr << "Could not write checkpoint '" << m_checkpoint_filename
+      << "'." << std::endl;
+  }
+}
+
+inline void Optimizer::WriteCheckpointIfDue()
+{
+  std::string contents;
+  if (GetCheckpointIfDue(m_generation_index, contents)) {
+    WriteCheckpoint(contents);
+  }
+}
+
+inline void Optimizer::WriteString(std::ostream &out,
+    std::string const &value)
+{
+  uint64_t const size = value.size();
+  Write(out, &size, sizeof(size));
+  Write(out, value.data(), size);
+}
+
+// Writes a checkpoint to the given file after every interval generations.
+// The optional function provides user data to store with it.
+void Optimizer::SetCheckpoint(std::string const &filename,
+    uint32_t const interval, std::function<std::string()> checkpoint_data)
+{
+  m_checkpoint_filename = filename;
+  m_checkpoint_interval = interval;
+  m_checkpoint_data = checkpoint_data;
+}
+
+// Reseeds the random number generator and starts the search over. Processes
+// started within the same second otherwise begin identically.
+void Optimizer::SetRandomSeed(uint32_t const seed)
+{
+  m_generator.seed(seed);
+  Initialize();
+}
+
+// Evaluates every candidate seed_count times instead, once with each of
+// seed_count seeds that are drawn at the start of every generation and
+// shared by all its candidates (common random numbers). The evaluation
+// function gets the seed along with the individual and its index. Fitness
+// is the mean over the seeds, see GetFitnessVariances for the spread. Only
+// the genetic algorithm's generational mode offers it, as there every
+// candidate, the elite included, is scored again on each generation's
+// seeds; differential evolution and the particle swarm would compare new
+// candidates with incumbents scored on earlier seeds. Not used with batch
+// evaluation.
+void Optimizer::SetSeededEvaluation(uint32_t const seed_count,
+    std::function<double(Individual const &, uint32_t const, uint64_t const)>
+    evaluate_seeded)
+{
+  m_evaluation_seeds.assign(std::max(1u, seed_count), 0);
+  m_evaluate_seeded = evaluate_seeded;
+}
+
+class GeneticAlgorithm : public Optimizer {
+  public:
+    GeneticAlgorithm(std::function<double(Individual const &, uint32_t const)>,
+        CrossoverMethod const, uint32_t const, uint32_t const, uint32_t const, 
+        uint32_t const, float const, float const, float const);
+    virtual ~GeneticAlgorithm();
+    uint64_t GetCacheHitCount() const;
+    uint64_t GetCacheLookupCount() const;
+    virtual std::string GetName() const;
+    Fitnesses GetRacingThresholds() const;
+    void RunSteadyState(uint32_t const, uint32_t const,
+        std::function<bool(SteadyStateGeneration const &)> = nullptr);
+    void SetCrossoverIndividuals(
+        std::function<std::pair<Individual, Individual>(Individual const &,
+          Individual const &)>);
+    void SetEvaluatePopulation(
+        std::function<Fitnesses(Population const &)>);
+    void SetEvaluationCache(CachePolicy const, uint32_t const = 1,
+        uint32_t const = 1 << 20);
+    void SetEvaluationSeed(uint64_t const);
+    void SetMigration(uint32_t const, uint32_t const,
+        std::function<std::pair<Population, Fitnesses>(Population const &,
+          Fitnesses const &)>);
+    void SetMutateIndividual(std::function<Individual(Individual const &)>);
+    void SetRacing(std::vector<double> const &,
+        std::function<double(Individual const &, uint32_t const,
+          Fitnesses const &)>);
+    using Optimizer::SetSeededEvaluation;
+    void SetSurrogate(uint32_t const, uint32_t const = 256);
+
+  protected:
+    virtual Fitnesses Evaluate(uint32_t const);
+    virtual double EvaluateIndividual(Individual const &, uint32_t const);
+    virtual void Initialize();
+    virtual void Propose();
+    virtual bool ReadState(std::string const &);
+    virtual void Update();
+    virtual std::string WriteState() const;
+
+  private:
+    GeneticAlgorithm(GeneticAlgorithm const &);
+    GeneticAlgorithm &operator=(GeneticAlgorithm const &);
+    void CrossoverIndividuals(double const *, double const *, double *,
+        double *);
+    struct CacheEntry {
+      double sum{0.0};
+      uint32_t samples{0};
+    };
+
+    double AddToCache(std::string const &, double const);
+    void BreedIndividual(double *);
+    void BreedRows(GenomeMatrix &, uint32_t const, uint32_t const);
+    Fitnesses EvaluateRowsBatched(std::vector<uint32_t> const &,
+        uint32_t const);
+    std::string GetCacheKey(double const *) const;
+    std::vector<uint32_t> GetFitnessOrder() const;
+    bool IsCacheEntryFinal(CacheEntry const &) const;
+    bool LookUpCache(double const *, std::string &, double &);
+    void Migrate();
+    void MutateIndividual(double *);
+    void ScreenOffspring();
+    void SelectEmigrants(Population &, Fitnesses &) const;
+    uint32_t SelectTournament(Fitnesses const &);
+    void TakeImmigrants(std::pair<Population, Fitnesses> const &);
+    void UpdateRacingThresholds();
+
+    std::function<std::pair<Individual, Individual>(Individual const &,
+        Individual const &)> m_crossover_individuals;
+    std::function<Fitnesses(Population const &)> m_evaluate_population;
+    std::function<double(Individual const &, uint32_t const, 
+        Fitnesses const &)> m_evaluate_individual_racing;
+    std::function<std::pair<Population, Fitnesses>(Population const &,
+        Fitnesses const &)> m_migrate;
+    std::function<Individual(Individual const &)> m_mutate_individual;
+    std::unordered_map<std::string, CacheEntry> m_cache;
+    std::unique_ptr<GenomeMatrix> m_candidates;
+    std::unique_ptr<RbfSurrogate> m_surrogate;
+    CachePolicy m_cache_policy;
+    CrossoverMethod m_crossover_method;
+    Fitnesses m_racing_thresholds;
+    std::vector<double> m_racing_quantiles;
+    Individual m_scratch;
+    uint64_t m_cache_hits;
+    uint64_t m_cache_lookups;
+    uint64_t m_evaluation_seed;
+    float const m_prob_crossover;
+    float const m_prob_mutation;
+    float const m_prob_select_tournament;
+    uint32_t m_cache_capacity;
+    uint32_t m_cache_samples;
+    uint32_t m_migration_count;
+    uint32_t m_migration_interval;
+    uint32_t const m_elite_size;
+    uint32_t const m_tournament_size;
+    bool m_cache_enabled;
+};
+
+inline GeneticAlgorithm::GeneticAlgorithm(
+    std::function<double(Individual const &, uint32_t const)> evaluate_individual,
+    CrossoverMethod const crossover_method, uint32_t const individual_length, 
+    uint32_t const elite_size, uint32_t const population_size, 
+    uint32_t const tournament_size, float prob_crossover, float prob_mutation,
+    float prob_select_tournament):
+  Optimizer(evaluate_individual, individual_length, population_size),
+  m_crossover_individuals(nullptr),
+  m_evaluate_population(nullptr),
+  m_evaluate_individual_racing(nullptr),
+  m_migrate(nullptr),
+  m_mutate_individual(nullptr),
+  m_cache(),
+  m_candidates(),
+  m_surrogate(),
+  m_cache_policy(CachePolicy::Exact),
+  m_crossover_method(crossover_method),
+  m_racing_thresholds(),
+  m_racing_quantiles(),
+  m_scratch(individual_length),
+  m_cache_hits(0),
+  m_cache_lookups(0),
+  m_evaluation_seed(0),
+  m_prob_crossover(prob_crossover),
+  m_prob_mutation(prob_mutation),
+  m_prob_select_tournament(prob_select_tournament),
+  m_cache_capacity(0),
+  m_cache_samples(0),
+  m_migration_count(0),
+  m_migration_interval(0),
+  m_elite_size(elite_size),
+  m_tournament_size(tournament_size),
+  m_cache_enabled(false)
+{
+  Initialize();
+}
+
+inline GeneticAlgorithm::~GeneticAlgorithm()
+{
+}
+
+// Adds a sample to the cache, emptying it first if it is full, and returns
+// the mean of the genome's samples.
+inline double GeneticAlgorithm::AddToCache(std::string const &key,
+    double const fitness)
+{
+  if (m_cache.size() >= m_cache_capacity && m_cache.count(key) == 0) {
+    m_cache.clear();
+  }
+  CacheEntry &entry = m_cache[key];
+  entry.sum += fitness;
+  entry.samples++;
+  return entry.sum / entry.samples;
+}
+
+// Breeds a new offspring from the current population into the given genome,
+// as in Update.
+inline void GeneticAlgorithm::BreedIndividual(double *offspring)
+{
+  uint32_t const index_selected_1 = SelectTournament(m_fitnesses);
+  uint32_t const index_selected_2 = SelectTournament(m_fitnesses);
+  CrossoverIndividuals(m_population->Row(index_selected_1),
+      m_population->Row(index_selected_2), offspring, m_scratch.data());
+  MutateIndividual(offspring);
+}
+
+// Breeds rows begin to end of the given matrix from the current population,
+// two offspring from every pair of tournament winners.
+inline void GeneticAlgorithm::BreedRows(GenomeMatrix &offspring,
+    uint32_t const begin, uint32_t const end)
+{
+  for (uint32_t i{begin}; i < end; i = i + 2) {
+    uint32_t const index_selected_1 = SelectTournament(m_fitnesses);
+    uint32_t const index_selected_2 = SelectTournament(m_fitnesses);
+
+    double *individual_1 = offspring.Row(i);
+    double *individual_2 = (i + 1 < end) 
+      ? offspring.Row(i + 1) : m_scratch.data();
+    CrossoverIndividuals(m_population->Row(index_selected_1),
+        m_population->Row(index_selected_2), individual_1, individual_2);
+
+    MutateIndividual(individual_1);
+    if (i + 1 < end) {
+      MutateIndividual(individual_2);
+    }
+  }
+}
+
+// Writes the two crossed genomes of the given parents.
+inline void GeneticAlgorithm::CrossoverIndividuals(double const *individual_1,
+    double const *individual_2, double *crossed_1, double *crossed_2)
+{
+  uint32_t const individual_length = m_individual_length;
+
+  if (m_crossover_individuals != nullptr) {
+    std::pair<Individual, Individual> const pair = m_crossover_individuals(
+        Individual(individual_1, individual_1 + individual_length),
+        Individual(individual_2, individual_2 + individual_length));
+    std::copy(pair.first.begin(), pair.first.end(), crossed_1);
+    std::copy(pair.second.begin(), pair.second.end(), crossed_2);
+    return;
+  }
+
+  switch (m_crossover_method) {
+    case CrossoverMethod::Shuffle:
+      {
+        for (uint32_t i = 0; i < individual_length; ++i) {
+          float const r = GetRandomFloat();
+          if (r < 0.5) {
+            crossed_1[i] = individual_1[i];
+            crossed_2[i] = individual_2[i];
+          } else {
+            crossed_1[i] = individual_2[i];
+            crossed_2[i] = individual_1[i];
+          }
+        }
+        break;
+      }
+    case CrossoverMethod::Split:
+      {
+        uint32_t split_pos = GetRandomInteger(1, individual_length - 1);
+
+        std::copy(individual_1, individual_1 + split_pos, crossed_1);
+        std::copy(individual_2 + split_pos, individual_2 + individual_length,
+            crossed_1 + split_pos);
+        std::copy(individual_2, individual_2 + split_pos, crossed_2);
+        std::copy(individual_1 + split_pos, individual_1 + individual_length,
+            crossed_2 + split_pos);
+        break;
+      }
+  }
+}
+
+// Looks every individual up in the cache, if enabled, and evaluates only
+// those without a final entry. New samples are then added to the cache; the
+// cache is emptied when it reaches its capacity. With seeded evaluation the
+// cache is not used, since its entries do not know the generation's seeds.
+inline Fitnesses GeneticAlgorithm::Evaluate(uint32_t const cores)
+{
+  bool const use_cache = m_cache_enabled && m_evaluate_seeded == nullptr;
+  Fitnesses fitnesses(m_population_size);
+  std::vector<uint32_t> pending;
+  std::vector<std::string> keys;
+  if (use_cache) {
+    keys.resize(m_population_size);
+    for (uint32_t i{0}; i < m_population_size; i++) {
+      if (!LookUpCache(m_population->Row(i), keys[i], fitnesses[i])) {
+        pending.push_back(i);
+      }
+    }
+    if (pending.empty()) {
+      return fitnesses;
+    }
+  } else {
+    for (uint32_t i{0}; i < m_population_size; i++) {
+      pending.push_back(i);
+    }
+  }
+
+  Fitnesses const pending_fitnesses = (m_evaluate_population != nullptr)
+    ? EvaluateRowsBatched(pending, cores) : EvaluateRows(pending, cores);
+  if (!use_cache) {
+    return pending_fitnesses;
+  }
+
+  if (m_cache.size() + pending.size() > m_cache_capacity) {
+    m_cache.clear();
+  }
+  for (uint32_t k{0}; k < pending.size(); k++) {
+    CacheEntry &entry = m_cache[keys[pending[k]]];
+    entry.sum += pending_fitnesses[k];
+    entry.samples++;
+  }
+  for (uint32_t const i : pending) {
+    CacheEntry const &entry = m_cache[keys[i]];
+    fitnesses[i] = entry.sum / entry.samples;
+  }
+  return fitnesses;
+}
+
+// Uses the racing evaluator, if set, with this generation's thresholds.
+inline double GeneticAlgorithm::EvaluateIndividual(
+    Individual const &individual, uint32_t const index)
+{
+  return (m_evaluate_individual_racing != nullptr)
+    ? m_evaluate_individual_racing(individual, index, m_racing_thresholds)
+    : m_evaluate_individual(individual, index);
+}
+
+// Splits the rows into one contiguous chunk per core and hands each chunk to
+// the batch evaluator in a single call.
+inline Fitnesses GeneticAlgorithm::EvaluateRowsBatched(
+    std::vector<uint32_t> const &rows, uint32_t const cores)
+{
+  uint32_t const row_count = rows.size();
+  Fitnesses fitnesses(row_count);
+  uint32_t const chunk_count = std::max(1u, std::min(cores, row_count));
+  uint32_t const chunk_size = (row_count + chunk_count - 1) / chunk_count;
+  std::atomic<uint32_t> next_begin{0};
+
+  std::function<void()> const worker{[this, &rows, &fitnesses, &next_begin,
+    chunk_size, row_count]() {
+    while (true) {
+      uint32_t const begin = next_begin.fetch_add(chunk_size,
+          std::memory_order_relaxed);
+      if (begin >= row_count) {
+        break;
+      }
+      uint32_t const end = std::min(begin + chunk_size, row_count);
+      Population chunk;
+      chunk.reserve(end - begin);
+      for (uint32_t k{begin}; k < end; k++) {
+        double const *genome = m_population->Row(rows[k]);
+        chunk.emplace_back(genome, genome + m_individual_length);
+      }
+      Fitnesses chunk_fitnesses = m_evaluate_population(chunk);
+      std::copy(chunk_fitnesses.begin(), chunk_fitnesses.end(),
+          fitnesses.begin() + begin);
+    }
+  }};
+
+  m_workers.Run(chunk_count, worker);
+  return fitnesses;
+}
+
+// Draws a random initial population.
+inline void GeneticAlgorithm::Initialize()
+{
+  for (uint32_t i = 0; i < m_population_size; ++i) {
+    double *individual = m_population->Row(i);
+    for (uint32_t j = 0; j < m_individual_length; ++j) {      
+      individual[j] = GetRandomDouble();
+    }
+  }
+}
+
+inline uint64_t GeneticAlgorithm::GetCacheHitCount() const
+{
+  return m_cache_hits;
+}
+
+// The raw bytes of the genome, followed by the evaluation seed when the
+// evaluation is deterministic.
+inline std::string GeneticAlgorithm::GetCacheKey(
+    double const *individual) const
+{
+  std::string key(reinterpret_cast<char const *>(individual),
+      m_individual_length * sizeof(double));
+  if (m_cache_policy == CachePolicy::Exact) {
+    key.append(reinterpret_cast<char const *>(&m_evaluation_seed),
+        sizeof(m_evaluation_seed));
+  }
+  return key;
+}
+
+inline uint64_t GeneticAlgorithm::GetCacheLookupCount() const
+{
+  return m_cache_lookups;
+}
+
+// Indices of the individuals from the fittest to the least fit, with those
+// not evaluated last.
+inline std::vector<uint32_t> GeneticAlgorithm::GetFitnessOrder() const
+{
+  std::vector<uint32_t> order(m_population_size);
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [this](uint32_t const a, uint32_t const b) {
+        if (std::isnan(m_fitnesses[b])) {
+          return !std::isnan(m_fitnesses[a]);
+        }
+        return m_fitnesses[a] > m_fitnesses[b];
+      });
+  return order;
+}
+
+inline std::string GeneticAlgorithm::GetName() const
+{
+  return "ga";
+}
+
+inline Fitnesses GeneticAlgorithm::GetRacingThresholds() const
+{
+  return m_racing_thresholds;
+}
+
+inline bool GeneticAlgorithm::IsCacheEntryFinal(CacheEntry const &entry) const
+{
+  switch (m_cache_policy) {
+    case CachePolicy::Exact:
+      return entry.samples > 0;
+    case CachePolicy::Freeze:
+      return entry.samples >= m_cache_samples;
+    default:
+      return false;
+  }
+}
+
+// Sends the best individuals of the evaluated population to the migration
+// function and lets the individuals it returns, with their fitnesses, take
+// the places of the worst. Unevaluated (NaN) individuals count as the worst.
+inline void GeneticAlgorithm::Migrate()
+{
+  Population emigrants;
+  Fitnesses emigrant_fitnesses;
+  SelectEmigrants(emigrants, emigrant_fitnesses);
+  TakeImmigrants(m_migrate(emigrants, emigrant_fitnesses));
+}
+
+// Gives the genome's cache key, and its cached fitness if the entry is final.
+inline bool GeneticAlgorithm::LookUpCache(double const *individual,
+    std::string &key, double &fitness)
+{
+  key = GetCacheKey(individual);
+  m_cache_lookups++;
+  auto const it = m_cache.find(key);
+  if (it == m_cache.end() || !IsCacheEntryFinal(it->second)) {
+    return false;
+  }
+  fitness = it->second.sum / it->second.samples;
+  m_cache_hits++;
+  return true;
+}
+
+// Mutates the genome in place.
+inline void GeneticAlgorithm::MutateIndividual(double *individual)
+{
+  if (m_mutate_individual != nullptr) {
+    Individual const individual_mutated = m_mutate_individual(
+        Individual(individual, individual + m_individual_length));
+    std::copy(individual_mutated.begin(), individual_mutated.end(),
+        individual);
+    return;
+  }
+
+  float const r = GetRandomFloat();
+  if (r < m_prob_mutation) {
+    for (uint32_t i = 0; i < m_individual_length; ++i) {
+      double m = GetRandomCreep();
+
+      double x = individual[i] + m;
+      if (x < 0.0) {
+        x = -x;
+      }
+      if (x > 1.0) {
+        x = 2.0 - x;
+      }
+
+      individual[i] = x;
+    }
+  }
+}
+
+// The racing thresholds are taken from the last generation's fitnesses.
+inline void GeneticAlgorithm::Propose()
+{
+  UpdateRacingThresholds();
+}
+
+// The fitness cache and its counters, and the surrogate's samples.
+inline bool GeneticAlgorithm::ReadState(std::string const &state)
+{
+  std::istringstream in(state);
+  uint64_t cache_hits{0};
+  uint64_t cache_lookups{0};
+  uint64_t cache_size{0};
+  Read(in, &cache_hits, sizeof(cache_hits));
+  Read(in, &cache_lookups, sizeof(cache_lookups));
+  Read(in, &cache_size, sizeof(cache_size));
+
+  std::unordered_map<std::string, CacheEntry> cache;
+  for (uint64_t i{0}; in && i < cache_size; i++) {
+    std::string key;
+    CacheEntry entry;
+    ReadString(in, key);
+    Read(in, &entry.sum, sizeof(entry.sum));
+    Read(in, &entry.samples, sizeof(entry.samples));
+    cache[key] = entry;
+  }
+  std::string surrogate_state;
+  ReadString(in, surrogate_state);
+  if (!in || (m_surrogate && !surrogate_state.empty() 
+        && !m_surrogate->ReadState(surrogate_state))) {
+    return false;
+  }
+
+  m_cache = cache;
+  m_cache_hits = cache_hits;
+  m_cache_lookups = cache_lookups;
+  return true;
+}
+
+// Evolves without generations. Each of the cores workers evaluates one
+// individual at a time and, as soon as it is done, breeds the next offspring
+// from the current population, so no worker waits for the slowest
+// evaluation. A finished offspring replaces the worst individual if it is
+// fitter. The current population is evaluated first, by the same workers.
+// Every population size evaluations count as a generation, for
+// generation_count generations or until on_generation returns false. Batch
+// evaluation is not used.
+//
+// At the end of a generation the worker that finished it does what Ask() and
+// Tell() do between generations. Only the bookkeeping is done under the
+// lock; the migration call, the checkpoint write and on_generation, which
+// gets a copy of the state, run outside it while the other workers carry on.
+// Generation ends are handled one at a time and in order. A checkpoint
+// holds the state as of its generation's end, without the evaluations that
+// were still running.
+inline void GeneticAlgorithm::RunSteadyState(uint32_t const cores,
+    uint32_t const generation_count, 
+    std::function<bool(SteadyStateGeneration const &)> on_generation)
+{
+  uint64_t const evaluation_count = static_cast<uint64_t>(generation_count)
+    * m_population_size;
+  std::mutex mutex;
+  std::mutex end_mutex;
+  std::condition_variable end_changed;
+  uint32_t next_end{static_cast<uint32_t>(m_generation_index) + 1};
+  uint64_t dispatched{0};
+  uint64_t completed{0};
+  uint32_t initial_index{0};
+  bool stopped{false};
+  m_fitnesses.assign(m_population_size, 
+      std::numeric_limits<double>::quiet_NaN());
+
+  std::function<void()> const worker{[this, &mutex, &end_mutex, &end_changed,
+    &next_end, &dispatched, &completed, &initial_index, &stopped, 
+    &on_generation, evaluation_count]() {
+    Individual individual(m_individual_length);
+    while (true) {
+      Fitnesses thresholds;
+      std::string key;
+      double fitness{0.0};
+      bool cached{false};
+      bool initial{false};
+      uint32_t index{0};
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopped || dispatched >= evaluation_count) {
+          break;
+        }
+        index = static_cast<uint32_t>(dispatched % m_population_size);
+        dispatched++;
+        initial = (initial_index < m_population_size);
+        if (initial) {
+          index = initial_index++;
+          double const *genome = m_population->Row(index);
+          std::copy(genome, genome + m_individual_length, individual.begin());
+        } else {
+          BreedIndividual(individual.data());
+        }
+        thresholds = m_racing_thresholds;
+        cached = m_cache_enabled 
+          && LookUpCache(individual.data(), key, fitness);
+      }
+
+      if (!cached) {
+        fitness = (m_evaluate_individual_racing != nullptr)
+          ? m_evaluate_individual_racing(individual, index, thresholds)
+          : m_evaluate_individual(individual, index);
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!cached && m_cache_enabled) {
+        fitness = AddToCache(key, fitness);
+      }
+      if (initial) {
+        m_fitnesses[index] = fitness;
+      } else if (!std::isnan(fitness)) {
+        // Individuals of the initial population still being evaluated are
+        // not replaced.
+        int32_t i_lowest{-1};
+        for (uint32_t i{0}; i < m_population_size; i++) {
+          if (!std::isnan(m_fitnesses[i]) && (i_lowest < 0 
+                || m_fitnesses[i] < m_fitnesses[i_lowest])) {
+            i_lowest = i;
+          }
+        }
+        if (i_lowest >= 0 && fitness > m_fitnesses[i_lowest]) {
+          std::copy(individual.begin(), individual.end(),
+              m_population->Row(i_lowest));
+          m_fitnesses[i_lowest] = fitness;
+        }
+      }
+      if (!std::isnan(fitness) && fitness > m_best_fitness) {
+        m_best_fitness = fitness;
+        m_best_individual = individual;
+      }
+
+      completed++;
+      if (completed % m_population_size != 0) {
+        continue;
+      }
+
+      m_generation_index++;
+      uint32_t const generation_index = m_generation_index;
+      UpdateRacingThresholds();
+      bool const migrate = m_migrate != nullptr && m_migration_interval > 0
+        && generation_index % m_migration_interval == 0;
+      Population emigrants;
+      Fitnesses emigrant_fitnesses;
+      if (migrate) {
+        SelectEmigrants(emigrants, emigrant_fitnesses);
+      }
+      lock.unlock();
+
+      std::unique_lock<std::mutex> end_lock(end_mutex);
+      end_changed.wait(end_lock, [&next_end, generation_index]() {
+          return next_end == generation_index;
+        });
+
+      std::pair<Population, Fitnesses> immigrants;
+      if (migrate) {
+        immigrants = m_migrate(emigrants, emigrant_fitnesses);
+      }
+
+      std::string checkpoint;
+      SteadyStateGeneration generation;
+      lock.lock();
+      TakeImmigrants(immigrants);
+      bool const checkpoint_due = GetCheckpointIfDue(generation_index, 
+          checkpoint);
+      if (on_generation != nullptr) {
+        generation.generation_index = generation_index;
+        generation.population = GetPopulation();
+        generation.fitnesses = m_fitnesses;
+        generation.best_individual = m_best_individual;
+        generation.best_fitness = m_best_fitness;
+      }
+      lock.unlock();
+
+      if (checkpoint_due) {
+        WriteCheckpoint(checkpoint);
+      }
+      bool const proceed = on_generation == nullptr 
+        || on_generation(generation);
+      next_end++;
+      end_changed.notify_all();
+      end_lock.unlock();
+
+      if (!proceed) {
+        lock.lock();
+        stopped = true;
+      }
+    }
+  }};
+
+  m_workers.Run(cores, worker);
+}
+
+// Breeds the candidate pool and keeps the offspring that the surrogate
+// predicts to be fittest.
+inline void GeneticAlgorithm::ScreenOffspring()
+{
+  uint32_t const offspring_count = m_population_size - m_elite_size;
+  uint32_t const candidate_count = m_candidates->GetRowCount();
+  BreedRows(*m_candidates, 0, candidate_count);
+
+  std::vector<double> predictions(candidate_count);
+  std::vector<uint32_t> order(candidate_count);
+  for (uint32_t k{0}; k < candidate_count; k++) {
+    double deviation{0.0};
+    predictions[k] = m_surrogate->Predict(m_candidates->Row(k), &deviation);
+    predictions[k] += SURROGATE_EXPLORATION * deviation;
+    order[k] = k;
+  }
+  uint32_t const kept_count = std::min(offspring_count, candidate_count);
+  std::partial_sort(order.begin(), order.begin() + kept_count, order.end(),
+      [&predictions](uint32_t const a, uint32_t const b) {
+        return predictions[a] > predictions[b];
+      });
+
+  for (uint32_t k{0}; k < kept_count; k++) {
+    double const *genome = m_candidates->Row(order[k]);
+    std::copy(genome, genome + m_individual_length,
+        m_population_next->Row(m_elite_size + k));
+  }
+}
+
+// Copies the migration count fittest individuals, with their fitnesses.
+inline void GeneticAlgorithm::SelectEmigrants(Population &emigrants,
+    Fitnesses &fitnesses) const
+{
+  std::vector<uint32_t> const order = GetFitnessOrder();
+  uint32_t const emigrant_count = std::min(m_migration_count, 
+      m_population_size);
+  emigrants.resize(emigrant_count);
+  fitnesses.resize(emigrant_count);
+  for (uint32_t k{0}; k < emigrant_count; k++) {
+    double const *genome = m_population->Row(order[k]);
+    emigrants[k].assign(genome, genome + m_individual_length);
+    fitnesses[k] = m_fitnesses[order[k]];
+  }
+}
+
+// Returns the index of the tournament winner.
+inline uint32_t GeneticAlgorithm::SelectTournament(Fitnesses const &fitnesses)
+{
+  uint32_t const population_size = m_population_size;
+
+  uint32_t index_best = GetRandomInteger(0, population_size - 1);
+  double fitness_best = fitnesses[index_best];
+
+  for (uint32_t i = 0; i < m_tournament_size - 1; ++i) {
+    uint32_t const index = GetRandomInteger(0, population_size - 1);
+    double const fitness = fitnesses[index];
+    if (fitness > fitness_best) {
+      index_best = index;
+      fitness_best = fitness;
+    }
+  }
+
+  return index_best;
+}
+
+// Replaces the least fit individuals with the immigrants.
+inline void GeneticAlgorithm::TakeImmigrants(
+    std::pair<Population, Fitnesses> const &immigrants)
+{
+  std::vector<uint32_t> const order = GetFitnessOrder();
+  uint32_t const immigrant_count = std::min<uint32_t>(
+      immigrants.first.size(), m_population_size);
+  for (uint32_t k{0}; k < immigrant_count; k++) {
+    uint32_t const i = order[m_population_size - 1 - k];
+    Individual const &immigrant = immigrants.first[k];
+    std::copy(immigrant.begin(), immigrant.begin() 
+        + std::min<size_t>(immigrant.size(), m_individual_length),
+        m_population->Row(i));
+    m_fitnesses[i] = immigrants.second[k];
+  }
+}
+
+// Takes in migrants, keeps the best individual and breeds the next
+// generation straight into the second genome matrix, which then becomes the
+// current one.
+inline void GeneticAlgorithm::Update()
+{
+  if (m_migrate != nullptr && m_migration_interval > 0
+      && m_generation_index % m_migration_interval == 0) {
+    Migrate();
+  }
+
+  // On seeded evaluation the whole population, the elite included, was just
+  // scored on this generation's seeds, so the best is this generation's
+  // best rather than an individual that was once lucky on other seeds.
+  if (m_evaluate_seeded != nullptr) {
+    m_best_fitness = std::numeric_limits<double>::lowest();
+  }
+  UpdateBest();
+
+  if (m_surrogate) {
+    for (uint32_t i{0}; i < m_fitnesses.size(); i++) {
+      if (!std::isnan(m_fitnesses[i])) {
+        m_surrogate->Add(m_population->Row(i), m_fitnesses[i]);
+      }
+    }
+  }
+
+  for (uint32_t i{0}; i < m_elite_size; i++) {
+    std::copy(m_best_individual.begin(), m_best_individual.end(),
+        m_population_next->Row(i));
+  }
+
+  // The surrogate is trusted once it has seen a population's worth of
+  // evaluations.
+  if (m_surrogate && m_surrogate->GetSampleCount() >= m_population_size) {
+    ScreenOffspring();
+  } else {
+    BreedRows(*m_population_next, m_elite_size, m_population_size);
+  }
+
+  std::swap(m_population, m_population_next);
+}
+
+inline void GeneticAlgorithm::UpdateRacingThresholds()
+{
+  m_racing_thresholds.clear();
+  Fitnesses sorted;
+  for (double const fitness : m_fitnesses) {
+    if (!std::isnan(fitness)) {
+      sorted.push_back(fitness);
+    }
+  }
+  if (sorted.empty()) {
+    return;
+  }
+  std::sort(sorted.begin(), sorted.end());
+  for (double const quantile : m_racing_quantiles) {
+    double const position = std::min(1.0, std::max(0.0, quantile)) 
+      * (sorted.size() - 1);
+    m_racing_thresholds.push_back(sorted[static_cast<uint32_t>(position)]);
+  }
+}
+
+inline std::string GeneticAlgorithm::WriteState() const
+{
+  std::ostringstream out;
+  uint64_t const cache_size = m_cache.size();
+  Write(out, &m_cache_hits, sizeof(m_cache_hits));
+  Write(out, &m_cache_lookups, sizeof(m_cache_lookups));
+  Write(out, &cache_size, sizeof(cache_size));
+  for (auto const &entry : m_cache) {
+    WriteString(out, entry.first);
+    Write(out, &entry.second.sum, sizeof(entry.second.sum));
+    Write(out, &entry.second.samples, sizeof(entry.second.samples));
+  }
+  WriteString(out, m_surrogate ? m_surrogate->WriteState() : "");
+  return out.str();
+}
+
+void GeneticAlgorithm::SetCrossoverIndividuals(std::function<std::pair<
+    Individual, Individual>(Individual const &, Individual const &)> 
+    crossover_individuals)
+{
+  m_crossover_individuals = crossover_individuals;
+}
+
+void GeneticAlgorithm::SetEvaluatePopulation(
+    std::function<Fitnesses(Population const &)> evaluate_population)
+{
+  m_evaluate_population = evaluate_population;
+}
 
-  private:
-    GeneticAlgorithm(GeneticAlgorithm const &);
-    GeneticAlgorithm &operator=(GeneticAlgorithm const &);
-    std::pair<Individual, Individual> CrossoverIndividuals(Individual const &,
-        Individual const &);
-    Fitnesses EvaluatePopulation(Population const &, uint32_t const);
-    Population GeneratePopulation(uint32_t const);
-    uint32_t GetRandomInteger(uint32_t, uint32_t);
-    double GetRandomCreep();
-    double GetRandomDouble();
-    float GetRandomFloat();
-    Individual MutateIndividual(Individual const &);
-    Individual SelectTournament(Population const &, Fitnesses const &);
+// Turns on the fitness cache. For CachePolicy::Freeze, samples is the number
+// of evaluations averaged before a genome's fitness is frozen. At most
+// capacity genomes are kept.
+void GeneticAlgorithm::SetEvaluationCache(CachePolicy const cache_policy,
+    uint32_t const samples, uint32_t const capacity)
+{
+  m_cache.clear();
+  m_cache_policy = cache_policy;
+  m_cache_samples = std::max(1u, samples);
+  m_cache_capacity = capacity;
+  m_cache_enabled = true;
+}
 
-    std::default_random_engine m_generator;
-    std::function<std::pair<Individual, Individual>(Individual const &,
-        Individual const &)> m_crossover_individuals;
-    std::function<double(Individual const &, uint32_t const)> 
-      m_evaluate_individual;
-    std::function<Individual(Individual const &)> m_mutate_individual;
-    CrossoverMethod m_crossover_method;
-    Fitnesses m_fitnesses;
-    Individual m_best_individual;
-    Population m_population;
-    double m_best_fitness;
-    float const m_prob_crossover;
-    float const m_prob_mutation;
-    float const m_prob_select_tournament;
-    uint32_t m_generation_index;
-    uint32_t const m_elite_size;
-    uint32_t const m_population_size;
-    uint32_t const m_tournament_size;
-};
+// The seed the evaluation function uses, part of the cache key for
+// CachePolicy::Exact.
+void GeneticAlgorithm::SetEvaluationSeed(uint64_t const evaluation_seed)
+{
+  m_evaluation_seed = evaluation_seed;
+}
 
-inline GeneticAlgorithm::GeneticAlgorithm(
-    std::function<double(Individual const &, uint32_t const)> evaluate_individual,
-    CrossoverMethod const crossover_method, uint32_t const individual_length, 
-    uint32_t const elite_size, uint32_t const population_size, 
-    uint32_t const tournament_size, float prob_crossover, float prob_mutation,
-    float prob_select_tournament):
-  m_generator(time(0)),
-  m_crossover_individuals(nullptr),
-  m_evaluate_individual(evaluate_individual),
-  m_mutate_individual(nullptr),
-  m_crossover_method(crossover_method),
-  m_fitnesses(),
-  m_best_individual(),
-  m_population(),
-  m_best_fitness(std::numeric_limits<double>::lowest()),
-  m_prob_crossover(prob_crossover),
-  m_prob_mutation(prob_mutation),
-  m_prob_select_tournament(prob_select_tournament),
-  m_generation_index(0),
-  m_elite_size(elite_size),
-  m_population_size(population_size),
-  m_tournament_size(tournament_size)
+// Evaluates individuals with a racing evaluator instead. Along with the
+// individual it gets the given quantiles (0-1) of the previous generation's
+// fitnesses, and may stop an evaluation early once the individual cannot
+// reach them. The thresholds are empty in the first generation. The value
+// returned for a stopped evaluation is not a measurement, yet it is cached
+// and given to the surrogate like any other, so racing should not be
+// combined with SetEvaluationCache or SetSurrogate.
+void GeneticAlgorithm::SetRacing(std::vector<double> const &quantiles,
+    std::function<double(Individual const &, uint32_t const, 
+      Fitnesses const &)> evaluate_individual_racing)
 {
-  m_population = GeneratePopulation(individual_length);
+  m_racing_quantiles = quantiles;
+  m_evaluate_individual_racing = evaluate_individual_racing;
 }
 
-inline GeneticAlgorithm::~GeneticAlgorithm()
+// Exchanges individuals with other populations (the island model) every
+// interval generations, after evaluation. The function gets the count best
+// individuals and their fitnesses, and returns the individuals to take in,
+// with fitnesses, which replace the worst ones. It may return none.
+void GeneticAlgorithm::SetMigration(uint32_t const interval,
+    uint32_t const count, std::function<std::pair<Population, Fitnesses>(
+      Population const &, Fitnesses const &)> migrate)
 {
+  m_migration_interval = interval;
+  m_migration_count = count;
+  m_migrate = migrate;
 }
 
-inline std::pair<Individual, Individual> GeneticAlgorithm::CrossoverIndividuals(
-    Individual const &individual_1, Individual const &individual_2)
+// Pre-screens offspring with a model of the fitness (see RbfSurrogate),
+// fitted to the last capacity evaluations. Each generation pool times as
+// many offspring as needed are bred, and only those with the highest
+// predicted fitness are evaluated. Not used in the steady-state mode.
+void GeneticAlgorithm::SetSurrogate(uint32_t const pool, 
+    uint32_t const capacity)
 {
-  if (m_crossover_individuals != nullptr) {
-    return m_crossover_individuals(individual_1, individual_2);
-  }
+  m_surrogate.reset(new RbfSurrogate(m_individual_length, capacity));
+  m_candidates.reset(new GenomeMatrix(std::max(1u, pool) 
+        * (m_population_size - m_elite_size), m_individual_length));
+}
 
-  switch (m_crossover_method) {
-    case CrossoverMethod::Shuffle:
-      {
-        uint32_t const individual_length = individual_1.size();
+void GeneticAlgorithm::SetMutateIndividual(
+    std::function<Individual(Individual const &)> mutate_individual)
+{
+  m_mutate_individual = mutate_individual;
+}
 
-        Individual crossed_1(individual_length);
-        Individual crossed_2(individual_length);
+// Covariance matrix adaptation evolution strategy (CMA-ES), maximizing the
+// fitness like GeneticAlgorithm and with the same evaluation function. Each
+// generation samples population size candidates from a multivariate normal
+// distribution around the mean and, once they are evaluated, moves the mean,
+// the step size and the covariance matrix towards the best half. Genes are
+// kept in [0, 1] by reflection, as in GeneticAlgorithm's mutation, and the
+// reflected candidates are used in the update. Defaults follow Hansen's
+// tutorial (arXiv:1604.00772).
+class CmaEs : public Optimizer {
+  public:
+    CmaEs(std::function<double(Individual const &, uint32_t const)>,
+        uint32_t const, uint32_t const = 0, double const = 0.3);
+    virtual ~CmaEs();
+    Individual GetMean() const;
+    virtual std::string GetName() const;
+    double GetSigma() const;
 
-        for (uint32_t i = 0; i < individual_length; ++i) {
-          float const r = GetRandomFloat();
-          if (r < 0.5) {
-            crossed_1[i] = individual_1[i];
-            crossed_2[i] = individual_2[i];
-          } else {
-            crossed_1[i] = individual_2[i];
-            crossed_2[i] = individual_1[i];
-          }
-        }
+  protected:
+    virtual void Initialize();
+    virtual void Propose();
+    virtual bool ReadState(std::string const &);
+    virtual void Update();
+    virtual std::string WriteState() const;
 
-        std::pair<Individual, Individual> pair(crossed_1, crossed_2);
-        return pair;
-      }
-    case CrossoverMethod::Split:
-      {
-        uint32_t const individual_length = individual_1.size();
+  private:
+    CmaEs(CmaEs const &);
+    CmaEs &operator=(CmaEs const &);
+    void UpdateDistribution();
+    void UpdateEigensystem();
 
-        uint32_t split_pos = GetRandomInteger(1, individual_length - 1);
+    Fitnesses m_weights;
+    std::vector<double> m_b;
+    std::vector<double> m_c;
+    std::vector<double> m_d;
+    std::vector<double> m_mean;
+    std::vector<double> m_p_c;
+    std::vector<double> m_p_sigma;
+    double m_c_1;
+    double m_c_c;
+    double m_c_mu;
+    double m_c_sigma;
+    double m_chi_n;
+    double m_d_sigma;
+    double m_mu_eff;
+    double m_sigma;
+    uint32_t const m_mu;
+};
+
+// The population size defaults to 4 + 3 ln(individual length).
+inline CmaEs::CmaEs(
+    std::function<double(Individual const &, uint32_t const)> evaluate_individual,
+    uint32_t const individual_length, uint32_t const population_size,
+    double const sigma):
+  Optimizer(evaluate_individual, individual_length, (population_size > 1) 
+      ? population_size 
+      : 4 + static_cast<uint32_t>(3.0 * std::log(individual_length))),
+  m_weights(),
+  m_b(individual_length * individual_length, 0.0),
+  m_c(individual_length * individual_length, 0.0),
+  m_d(individual_length, 1.0),
+  m_mean(individual_length, 0.5),
+  m_p_c(individual_length, 0.0),
+  m_p_sigma(individual_length, 0.0),
+  m_c_1(0.0),
+  m_c_c(0.0),
+  m_c_mu(0.0),
+  m_c_sigma(0.0),
+  m_chi_n(0.0),
+  m_d_sigma(0.0),
+  m_mu_eff(0.0),
+  m_sigma(sigma),
+  m_mu(m_population_size / 2)
+{
+  double const n = individual_length;
 
-        Individual crossed_1(individual_length);
-        Individual crossed_2(individual_length);
+  double weight_sum{0.0};
+  double weight_square_sum{0.0};
+  for (uint32_t i{0}; i < m_mu; i++) {
+    double const weight = std::log(m_mu + 0.5) - std::log(i + 1.0);
+    m_weights.push_back(weight);
+    weight_sum += weight;
+  }
+  for (double &weight : m_weights) {
+    weight /= weight_sum;
+    weight_square_sum += weight * weight;
+  }
+  m_mu_eff = 1.0 / weight_square_sum;
 
-        for (uint32_t i = 0; i < individual_length; ++i) {
-          if (i < split_pos) {
-            crossed_1[i] = individual_1[i];
-            crossed_2[i] = individual_2[i];
-          } else {
-            crossed_1[i] = individual_2[i];
-            crossed_2[i] = individual_1[i];
-          }
-        }
+  m_c_c = (4.0 + m_mu_eff / n) / (n + 4.0 + 2.0 * m_mu_eff / n);
+  m_c_sigma = (m_mu_eff + 2.0) / (n + m_mu_eff + 5.0);
+  m_c_1 = 2.0 / ((n + 1.3) * (n + 1.3) + m_mu_eff);
+  m_c_mu = std::min(1.0 - m_c_1, 2.0 * (m_mu_eff - 2.0 + 1.0 / m_mu_eff) 
+      / ((n + 2.0) * (n + 2.0) + m_mu_eff));
+  m_d_sigma = 1.0 + 2.0 * std::max(0.0, std::sqrt((m_mu_eff - 1.0) 
+        / (n + 1.0)) - 1.0) + m_c_sigma;
+  m_chi_n = std::sqrt(n) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
 
-        std::pair<Individual, Individual> pair(crossed_1, crossed_2);
-        return pair;
-      }
-    default:
-      {
-        std::pair<Individual, Individual> emptyPair;
-        return emptyPair;
-      }
+  for (uint32_t i{0}; i < individual_length; i++) {
+    m_b[i * individual_length + i] = 1.0;
+    m_c[i * individual_length + i] = 1.0;
   }
+  Initialize();
 }
 
-inline Fitnesses GeneticAlgorithm::EvaluatePopulation(Population const &population,
-    uint32_t const cores)
+inline CmaEs::~CmaEs()
 {
-  Fitnesses fitnesses(m_population_size);
-  std::mutex selection_mutex;
-  std::mutex fitness_write_mutex;
-  uint32_t evaluated = 0;
-
-  auto worker{[this, &population, &fitnesses, &evaluated, &selection_mutex,
-    &fitness_write_mutex]() {
-    while (evaluated < m_population_size) {
-      uint32_t index;
-      {
-        std::lock_guard<std::mutex> lock(selection_mutex);
-        if (evaluated >= m_population_size) {
-          break;
-        }
-        index = evaluated;
-        evaluated++;
-      }
-      double fitness = m_evaluate_individual(population[index], index);
-      {
-        std::lock_guard<std::mutex> lock(fitness_write_mutex);
-        fitnesses[index] = fitness;
-      }
-    }
-  }};
+}
 
-  std::vector<std::thread> threads;
-  for (uint32_t i{0}; i < cores; i++) {
-    threads.push_back(std::thread(worker));
-  }
-  for (auto &t : threads) {
-    t.join();
+// Draws a random initial mean.
+inline void CmaEs::Initialize()
+{
+  for (double &x : m_mean) {
+    x = GetRandomDouble();
   }
+}
 
-  return fitnesses;
+inline Individual CmaEs::GetMean() const
+{
+  return m_mean;
 }
 
-inline Population GeneticAlgorithm::GeneratePopulation(uint32_t individual_length)
+inline std::string CmaEs::GetName() const
 {
-  Population population(m_population_size);
-  for (uint32_t i = 0; i < m_population_size; ++i) {
-    Individual individual(individual_length);
-    for (uint32_t j = 0; j < individual_length; ++j) {      
-      individual[j] = GetRandomDouble();
-    }
-    population[i] = individual;
-  }
-  return population;
+  return "cmaes";
 }
 
-inline double GeneticAlgorithm::GetBestFitness() const
+inline double CmaEs::GetSigma() const
 {
-  return m_best_fitness;
+  return m_sigma;
 }
 
-inline Individual GeneticAlgorithm::GetBestIndividual() const
+// Draws x = mean + sigma * B * D * z with z ~ N(0, I), folded into [0, 1].
+inline void CmaEs::Propose()
 {
-  return m_best_individual;
+  uint32_t const n = m_individual_length;
+  std::vector<double> z(n);
+  for (uint32_t k{0}; k < m_population_size; k++) {
+    for (uint32_t i{0}; i < n; i++) {
+      z[i] = m_d[i] * GetRandomNormal();
+    }
+    double *x = m_population->Row(k);
+    for (uint32_t i{0}; i < n; i++) {
+      double y{0.0};
+      for (uint32_t j{0}; j < n; j++) {
+        y += m_b[i * n + j] * z[j];
+      }
+      x[i] = Fold(m_mean[i] + m_sigma * y);
+    }
+  }
 }
 
-inline int32_t GeneticAlgorithm::GetGenerationIndex() const
+// The step size, covariance matrix, mean and evolution paths. The
+// eigensystem is recomputed from the covariance matrix.
+inline bool CmaEs::ReadState(std::string const &state)
 {
-  return m_generation_index;
+  uint32_t const n = m_individual_length;
+  std::istringstream in(state);
+  double sigma{0.0};
+  std::vector<double> c(n * n);
+  std::vector<double> mean(n);
+  std::vector<double> p_c(n);
+  std::vector<double> p_sigma(n);
+  Read(in, &sigma, sizeof(sigma));
+  Read(in, c.data(), n * n * sizeof(double));
+  Read(in, mean.data(), n * sizeof(double));
+  Read(in, p_c.data(), n * sizeof(double));
+  Read(in, p_sigma.data(), n * sizeof(double));
+  if (!in) {
+    return false;
+  }
+
+  m_sigma = sigma;
+  m_c = c;
+  m_mean = mean;
+  m_p_c = p_c;
+  m_p_sigma = p_sigma;
+  UpdateEigensystem();
+  return true;
 }
 
-inline Population GeneticAlgorithm::GetPopulation() const
+inline void CmaEs::Update()
 {
-  return m_population;
+  UpdateBest();
+  UpdateDistribution();
 }
 
-inline Fitnesses GeneticAlgorithm::GetFitnesses() const
+// Moves the mean to the weighted mean of the best half of the candidates
+// and adapts the evolution paths, the covariance matrix and the step size.
+inline void CmaEs::UpdateDistribution()
 {
-  return m_fitnesses;
+  uint32_t const n = m_individual_length;
+
+  std::vector<uint32_t> order(m_population_size);
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [this](uint32_t const a, uint32_t const b) {
+        if (std::isnan(m_fitnesses[b])) {
+          return !std::isnan(m_fitnesses[a]);
+        }
+        return m_fitnesses[a] > m_fitnesses[b];
+      });
+
+  std::vector<double> const mean_old = m_mean;
+  std::vector<double> y(m_mu * n);
+  std::vector<double> y_w(n, 0.0);
+  for (uint32_t k{0}; k < m_mu; k++) {
+    double const *x = m_population->Row(order[k]);
+    for (uint32_t i{0}; i < n; i++) {
+      y[k * n + i] = (x[i] - mean_old[i]) / m_sigma;
+      y_w[i] += m_weights[k] * y[k * n + i];
+    }
+  }
+  for (uint32_t i{0}; i < n; i++) {
+    m_mean[i] = mean_old[i] + m_sigma * y_w[i];
+  }
+
+  // C^(-1/2) * y_w = B * D^-1 * B^T * y_w.
+  std::vector<double> b_t_y(n, 0.0);
+  for (uint32_t j{0}; j < n; j++) {
+    for (uint32_t i{0}; i < n; i++) {
+      b_t_y[j] += m_b[i * n + j] * y_w[i];
+    }
+    b_t_y[j] /= m_d[j];
+  }
+  double const c_sigma_factor = std::sqrt(m_c_sigma * (2.0 - m_c_sigma) 
+      * m_mu_eff);
+  double p_sigma_norm{0.0};
+  for (uint32_t i{0}; i < n; i++) {
+    double c_y{0.0};
+    for (uint32_t j{0}; j < n; j++) {
+      c_y += m_b[i * n + j] * b_t_y[j];
+    }
+    m_p_sigma[i] = (1.0 - m_c_sigma) * m_p_sigma[i] + c_sigma_factor * c_y;
+    p_sigma_norm += m_p_sigma[i] * m_p_sigma[i];
+  }
+  p_sigma_norm = std::sqrt(p_sigma_norm);
+
+  double const generation_factor = std::sqrt(1.0 - std::pow(1.0 - m_c_sigma,
+        2.0 * m_generation_index));
+  bool const h_sigma = p_sigma_norm / generation_factor / m_chi_n 
+    < 1.4 + 2.0 / (n + 1.0);
+  double const c_c_factor = std::sqrt(m_c_c * (2.0 - m_c_c) * m_mu_eff);
+  for (uint32_t i{0}; i < n; i++) {
+    m_p_c[i] = (1.0 - m_c_c) * m_p_c[i] 
+      + (h_sigma ? c_c_factor * y_w[i] : 0.0);
+  }
+
+  double const c_old_factor = 1.0 - m_c_1 - m_c_mu 
+    + (h_sigma ? 0.0 : m_c_1 * m_c_c * (2.0 - m_c_c));
+  for (uint32_t i{0}; i < n; i++) {
+    for (uint32_t j{0}; j <= i; j++) {
+      double rank_mu{0.0};
+      for (uint32_t k{0}; k < m_mu; k++) {
+        rank_mu += m_weights[k] * y[k * n + i] * y[k * n + j];
+      }
+      double const c = c_old_factor * m_c[i * n + j] 
+        + m_c_1 * m_p_c[i] * m_p_c[j] + m_c_mu * rank_mu;
+      m_c[i * n + j] = c;
+      m_c[j * n + i] = c;
+    }
+  }
+
+  m_sigma *= std::exp(m_c_sigma / m_d_sigma * (p_sigma_norm / m_chi_n - 1.0));
+  UpdateEigensystem();
 }
 
-inline uint32_t GeneticAlgorithm::GetRandomInteger(uint32_t min, uint32_t max)
+// C = B * D^2 * B^T by cyclic Jacobi rotations, which is plenty for the
+// small dimensions used here.
+inline void CmaEs::UpdateEigensystem()
 {
-  std::uniform_int_distribution<uint32_t> int_distribution(min, max);
-  return int_distribution(m_generator);
+  uint32_t const n = m_individual_length;
+  std::vector<double> a = m_c;
+  std::fill(m_b.begin(), m_b.end(), 0.0);
+  for (uint32_t i{0}; i < n; i++) {
+    m_b[i * n + i] = 1.0;
+  }
+
+  for (uint32_t sweep{0}; sweep < 50; sweep++) {
+    double off_diagonal{0.0};
+    for (uint32_t p{0}; p < n; p++) {
+      for (uint32_t q{p + 1}; q < n; q++) {
+        off_diagonal += a[p * n + q] * a[p * n + q];
+      }
+    }
+    if (off_diagonal < 1e-30) {
+      break;
+    }
+
+    for (uint32_t p{0}; p < n; p++) {
+      for (uint32_t q{p + 1}; q < n; q++) {
+        double const a_pq = a[p * n + q];
+        if (std::fabs(a_pq) < 1e-300) {
+          continue;
+        }
+        double const theta = (a[q * n + q] - a[p * n + p]) / (2.0 * a_pq);
+        double const t = ((theta >= 0.0) ? 1.0 : -1.0) 
+          / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+        double const c = 1.0 / std::sqrt(t * t + 1.0);
+        double const s = t * c;
+        for (uint32_t k{0}; k < n; k++) {
+          double const a_kp = a[k * n + p];
+          double const a_kq = a[k * n + q];
+          a[k * n + p] = c * a_kp - s * a_kq;
+          a[k * n + q] = s * a_kp + c * a_kq;
+        }
+        for (uint32_t k{0}; k < n; k++) {
+          double const a_pk = a[p * n + k];
+          double const a_qk = a[q * n + k];
+          a[p * n + k] = c * a_pk - s * a_qk;
+          a[q * n + k] = s * a_pk + c * a_qk;
+        }
+        for (uint32_t k{0}; k < n; k++) {
+          double const b_kp = m_b[k * n + p];
+          double const b_kq = m_b[k * n + q];
+          m_b[k * n + p] = c * b_kp - s * b_kq;
+          m_b[k * n + q] = s * b_kp + c * b_kq;
+        }
+      }
+    }
+  }
+
+  for (uint32_t i{0}; i < n; i++) {
+    m_d[i] = std::sqrt(std::max(a[i * n + i], 1e-20));
+  }
 }
 
-inline double GeneticAlgorithm::GetRandomCreep()
+
+inline std::string CmaEs::WriteState() const
 {
-  std::normal_distribution<double> normal_distribution(0.0, 0.1);
-  return normal_distribution(m_generator);
+  std::ostringstream out;
+  Write(out, &m_sigma, sizeof(m_sigma));
+  Write(out, m_c.data(), m_c.size() * sizeof(double));
+  Write(out, m_mean.data(), m_mean.size() * sizeof(double));
+  Write(out, m_p_c.data(), m_p_c.size() * sizeof(double));
+  Write(out, m_p_sigma.data(), m_p_sigma.size() * sizeof(double));
+  return out.str();
 }
 
-inline double GeneticAlgorithm::GetRandomDouble()
+// Differential evolution (DE/rand/1/bin). Every parent gets one trial
+// candidate: the difference of two random parents, scaled by the weight, is
+// added to a third, and the result is crossed with the parent gene by gene
+// with the crossover rate. A trial that is at least as fit as its parent
+// replaces it. The random parents themselves are evaluated in the first
+// generation. Genes are kept in [0, 1] by reflection.
+class DifferentialEvolution : public Optimizer {
+  public:
+    DifferentialEvolution(
+        std::function<double(Individual const &, uint32_t const)>,
+        uint32_t const, uint32_t const, double const = 0.5,
+        double const = 0.9);
+    virtual ~DifferentialEvolution();
+    virtual std::string GetName() const;
+
+  protected:
+    virtual void Initialize();
+    virtual void Propose();
+    virtual bool ReadState(std::string const &);
+    virtual void Update();
+    virtual std::string WriteState() const;
+
+  private:
+    DifferentialEvolution(DifferentialEvolution const &);
+    DifferentialEvolution &operator=(DifferentialEvolution const &);
+
+    // The parents are kept in the second genome matrix.
+    Fitnesses m_parent_fitnesses;
+    double const m_crossover_rate;
+    double const m_weight;
+};
+
+// At least four parents are needed to draw three others for every parent.
+inline DifferentialEvolution::DifferentialEvolution(
+    std::function<double(Individual const &, uint32_t const)> evaluate_individual,
+    uint32_t const individual_length, uint32_t const population_size,
+    double const weight, double const crossover_rate):
+  Optimizer(evaluate_individual, individual_length, 
+      std::max(4u, population_size)),
+  m_parent_fitnesses(),
+  m_crossover_rate(crossover_rate),
+  m_weight(weight)
 {
-  std::uniform_real_distribution<double> uniform_distribution(0.0, 1.0);
-  return uniform_distribution(m_generator);
+  Initialize();
 }
 
-inline float GeneticAlgorithm::GetRandomFloat()
+inline DifferentialEvolution::~DifferentialEvolution()
 {
-  std::uniform_real_distribution<float> uniform_distribution(0.0, 1.0);
-  return uniform_distribution(m_generator);
 }
 
-inline Individual GeneticAlgorithm::MutateIndividual(
-    Individual const &individual)
+inline std::string DifferentialEvolution::GetName() const
 {
-  if (m_mutate_individual != nullptr) {
-    return m_mutate_individual(individual);
+  return "de";
+}
+
+// Draws random parents, which any trial replaces.
+inline void DifferentialEvolution::Initialize()
+{
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    double *parent = m_population_next->Row(i);
+    for (uint32_t j{0}; j < m_individual_length; j++) {
+      parent[j] = GetRandomDouble();
+    }
   }
+  m_parent_fitnesses.assign(m_population_size, 
+      std::numeric_limits<double>::lowest());
+}
 
-  float const r = GetRandomFloat();
-  if (r < m_prob_mutation) {
-    uint32_t const individual_length = individual.size();
-    Individual individual_mutated(individual_length);
-    for (uint32_t i = 0; i < individual_length; ++i) {
-      double m = GetRandomCreep();
+inline void DifferentialEvolution::Propose()
+{
+  uint32_t const n = m_individual_length;
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    double const *parent = m_population_next->Row(i);
+    double *trial = m_population->Row(i);
+    if (m_generation_index == 1) {
+      std::copy(parent, parent + n, trial);
+      continue;
+    }
 
-      double x = individual[i] + m;
-      if (x < 0.0) {
-        x = -x;
-      }
-      if (x > 1.0) {
-        x = 2.0 - x;
-      }
+    uint32_t r[3];
+    for (uint32_t k{0}; k < 3; k++) {
+      do {
+        r[k] = GetRandomInteger(0, m_population_size - 1);
+      } while (r[k] == i || (k > 0 && r[k] == r[0]) 
+          || (k > 1 && r[k] == r[1]));
+    }
+    double const *base = m_population_next->Row(r[0]);
+    double const *difference_1 = m_population_next->Row(r[1]);
+    double const *difference_2 = m_population_next->Row(r[2]);
 
-      individual_mutated[i] = x;
+    uint32_t const j_forced = GetRandomInteger(0, n - 1);
+    for (uint32_t j{0}; j < n; j++) {
+      trial[j] = (j == j_forced || GetRandomDouble() < m_crossover_rate)
+        ? Fold(base[j] + m_weight * (difference_1[j] - difference_2[j]))
+        : parent[j];
     }
-    return individual_mutated;
-  } else {
-    return individual;
   }
 }
 
-inline void GeneticAlgorithm::NextGeneration(uint32_t cores)
+// The parent fitnesses.
+inline bool DifferentialEvolution::ReadState(std::string const &state)
 {
-  m_generation_index++;
-
-  m_fitnesses = EvaluatePopulation(m_population, cores);
+  std::istringstream in(state);
+  Fitnesses parent_fitnesses(m_population_size);
+  Read(in, parent_fitnesses.data(), m_population_size * sizeof(double));
+  if (!in) {
+    return false;
+  }
+  m_parent_fitnesses = parent_fitnesses;
+  return true;
+}
 
-  uint32_t i_highest{0};
-  double highest_fitness{std::numeric_limits<double>::lowest()};
+// Unevaluated (NaN) trials never replace their parents.
+inline void DifferentialEvolution::Update()
+{
+  UpdateBest();
   for (uint32_t i{0}; i < m_fitnesses.size(); i++) {
-    if (!std::isnan(m_fitnesses[i]) && m_fitnesses[i] > highest_fitness) {
-      i_highest = i;
-      highest_fitness = m_fitnesses[i];
+    if (!std::isnan(m_fitnesses[i]) 
+        && m_fitnesses[i] >= m_parent_fitnesses[i]) {
+      double const *trial = m_population->Row(i);
+      std::copy(trial, trial + m_individual_length, m_population_next->Row(i));
+      m_parent_fitnesses[i] = m_fitnesses[i];
     }
   }
+}
 
-  if (highest_fitness > m_best_fitness) {
-    m_best_fitness = highest_fitness;
-    m_best_individual = m_population[i_highest];
-  }
+inline std::string DifferentialEvolution::WriteState() const
+{
+  std::ostringstream out;
+  Write(out, m_parent_fitnesses.data(), 
+      m_parent_fitnesses.size() * sizeof(double));
+  return out.str();
+}
+
+namespace {
+double const PSO_MAX_SPEED = 0.2;
+}
 
-  Population population_new(m_population_size);
+// Particle swarm optimization with inertia weight. Each particle is pulled
+// towards the best position it has found and towards the best individual
+// found by the swarm, with random weights. Speeds are limited to
+// PSO_MAX_SPEED per gene, and particles bounce off the bounds of [0, 1]. The
+// defaults are the constriction coefficients of Clerc and Kennedy.
+class ParticleSwarm : public Optimizer {
+  public:
+    ParticleSwarm(std::function<double(Individual const &, uint32_t const)>,
+        uint32_t const, uint32_t const, double const = 0.7298,
+        double const = 1.49618);
+    virtual ~ParticleSwarm();
+    virtual std::string GetName() const;
 
-  for (uint32_t i{0}; i < m_elite_size; i++) {
-    population_new[i] = m_best_individual;
-  }
+  protected:
+    virtual void Initialize();
+    virtual void Propose();
+    virtual bool ReadState(std::string const &);
+    virtual void Update();
+    virtual std::string WriteState() const;
+
+  private:
+    ParticleSwarm(ParticleSwarm const &);
+    ParticleSwarm &operator=(ParticleSwarm const &);
+
+    // The positions are the candidates, and the best position of each
+    // particle is kept in the second genome matrix.
+    Fitnesses m_personal_best_fitnesses;
+    std::vector<double> m_velocities;
+    double const m_acceleration;
+    double const m_inertia;
+};
 
-  for (uint32_t i{m_elite_size}; i < m_population_size; i = i + 2) {
-    Individual individual_selected_1 = SelectTournament(m_population,
-        m_fitnesses);
-    Individual individual_selected_2 = SelectTournament(m_population,
-        m_fitnesses);
+inline ParticleSwarm::ParticleSwarm(
+    std::function<double(Individual const &, uint32_t const)> evaluate_individual,
+    uint32_t const individual_length, uint32_t const population_size,
+    double const inertia, double const acceleration):
+  Optimizer(evaluate_individual, individual_length, population_size),
+  m_personal_best_fitnesses(),
+  m_velocities(),
+  m_acceleration(acceleration),
+  m_inertia(inertia)
+{
+  Initialize();
+}
 
-    std::pair<Individual, Individual> individual_pair = CrossoverIndividuals(
-        individual_selected_1, individual_selected_2);
+inline ParticleSwarm::~ParticleSwarm()
+{
+}
 
-    Individual individual_mutated_1 = MutateIndividual(individual_pair.first);
-    population_new[i] = individual_mutated_1;
+inline std::string ParticleSwarm::GetName() const
+{
+  return "pso";
+}
 
-    if (i + 1 < m_population_size) {
-      Individual individual_mutated_2 = MutateIndividual(
-          individual_pair.second);
-      population_new[i + 1] = individual_mutated_2;
+// Scatters the particles at random, with random velocities.
+inline void ParticleSwarm::Initialize()
+{
+  uint32_t const n = m_individual_length;
+  m_velocities.resize(m_population_size * n);
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    double *position = m_population->Row(i);
+    for (uint32_t j{0}; j < n; j++) {
+      position[j] = GetRandomDouble();
+      m_velocities[i * n + j] = (2.0 * GetRandomDouble() - 1.0) 
+        * PSO_MAX_SPEED;
     }
+    std::copy(position, position + n, m_population_next->Row(i));
   }
-
-  m_population = population_new;
+  m_personal_best_fitnesses.assign(m_population_size, 
+      std::numeric_limits<double>::lowest());
 }
 
-inline Individual GeneticAlgorithm::SelectTournament(Population const &population,
-    Fitnesses const &fitnesses)
+// Moves the particles, except in the first generation where their initial
+// positions are evaluated.
+inline void ParticleSwarm::Propose()
 {
-  uint32_t const population_size = population.size();
+  if (m_generation_index == 1) {
+    return;
+  }
 
-  uint32_t index_best = GetRandomInteger(0, population_size - 1);
-  double fitness_best = fitnesses[index_best];
+  uint32_t const n = m_individual_length;
+  for (uint32_t i{0}; i < m_population_size; i++) {
+    double *position = m_population->Row(i);
+    double const *personal_best = m_population_next->Row(i);
+    double const *global_best = m_best_individual.empty() 
+      ? personal_best : m_best_individual.data();
+    for (uint32_t j{0}; j < n; j++) {
+      double &velocity = m_velocities[i * n + j];
+      velocity = m_inertia * velocity 
+        + m_acceleration * GetRandomDouble() * (personal_best[j] - position[j])
+        + m_acceleration * GetRandomDouble() * (global_best[j] - position[j]);
+      velocity = std::min(PSO_MAX_SPEED, std::max(-PSO_MAX_SPEED, velocity));
 
-  for (uint32_t i = 0; i < m_tournament_size - 1; ++i) {
-    uint32_t const index = GetRandomInteger(0, population_size - 1);
-    double const fitness = fitnesses[index];
-    if (fitness > fitness_best) {
-      index_best = index;
-      fitness_best = fitness;
+      double x = position[j] + velocity;
+      if (x < 0.0 || x > 1.0) {
+        x = Fold(x);
+        velocity = -velocity;
+      }
+      position[j] = x;
     }
   }
+}
 
-  return population[index_best];
+// The velocities and the fitnesses of the best positions.
+inline bool ParticleSwarm::ReadState(std::string const &state)
+{
+  std::istringstream in(state);
+  std::vector<double> velocities(m_velocities.size());
+  Fitnesses personal_best_fitnesses(m_population_size);
+  Read(in, velocities.data(), velocities.size() * sizeof(double));
+  Read(in, personal_best_fitnesses.data(), 
+      m_population_size * sizeof(double));
+  if (!in) {
+    return false;
+  }
+  m_velocities = velocities;
+  m_personal_best_fitnesses = personal_best_fitnesses;
+  return true;
 }
 
-void GeneticAlgorithm::SetCrossoverIndividuals(std::function<std::pair<
-    Individual, Individual>(Individual const &, Individual const &)> 
-    crossover_individuals)
+inline void ParticleSwarm::Update()
 {
-  m_crossover_individuals = crossover_individuals;
+  UpdateBest();
+  for (uint32_t i{0}; i < m_fitnesses.size(); i++) {
+    if (!std::isnan(m_fitnesses[i]) 
+        && m_fitnesses[i] > m_personal_best_fitnesses[i]) {
+      double const *position = m_population->Row(i);
+      std::copy(position, position + m_individual_length, 
+          m_population_next->Row(i));
+      m_personal_best_fitnesses[i] = m_fitnesses[i];
+    }
+  }
 }
 
-void GeneticAlgorithm::SetMutateIndividual(
-    std::function<Individual(Individual const &)> mutate_individual)
+inline std::string ParticleSwarm::WriteState() const
 {
-  m_mutate_individual = mutate_individual;
+  std::ostringstream out;
+  Write(out, m_velocities.data(), m_velocities.size() * sizeof(double));
+  Write(out, m_personal_best_fitnesses.data(), 
+      m_personal_best_fitnesses.size() * sizeof(double));
+  return out.str();
 }
 
 }
@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_CONTROLLER_HPP
+#define TME290_LAWNMOWER_CONTROLLER_HPP
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "tme290-lawnmower-lawnmap.hpp"
+#include "tme290-lawnmower-navigation.hpp"
+
+namespace tme290 {
+namespace lawnmower {
+
+// Definitions and enumerations
+enum State { RETURN_TO_CHARGE, STAY_AND_CHARGE, RETURN_TO_LASTCUT, TRANSIENT_CUT, STATIONARY_CUT, STORE_LASTCUT, ERROR };
+static const int MOVE_STAY = 0;
+static const int MOVE_TOP_LEFT = 1;
+static const int MOVE_TOP_CENTRE = 2;
+static const int MOVE_TOP_RIGHT = 3;
+static const int MOVE_RIGHT = 4;
+static const int MOVE_BOTTOM_RIGHT = 5;
+static const int MOVE_BOTTOM_CENTRE = 6;
+static const int MOVE_BOTTOM_LEFT = 7;
+static const int MOVE_LEFT = 8;
+static const int32_t LAWNMAP_SEARCH_RANGE = 5;
+// The sweep heads down and to the right above this row and down and to the
+// left below it
+static const int32_t SWEEP_TURN_ROW = 17;
+
+// Parameters to be tuned
+struct Thresholds {
+  // If battery drains below this value the lawnmower will return to charge,
+  // one value per quadrant of the lawn
+  float batteryDrainQ1{0.2f};
+  float batteryDrainQ2{0.3f};
+  float batteryDrainQ3{0.4f};
+  float batteryDrainQ4{0.5f};
+  // If current grass value is above this value the lawnmower will stay and cut
+  float transientCutGrass{0.5f};
+  // If rain level is below this value then lawnmower can switch to stationary mode
+  float rainAvoidance{0.4f};
+  // Charging stops when the battery reaches this value
+  float batteryFull{0.98f};
+};
+
+// Conditions that can trigger a state transition
+enum Guard { ALWAYS, BATTERY_LOW, BATTERY_FULL, AT_CHARGER, AT_LASTCUT, GRASS_TALL, GRASS_TALL_AND_DRY };
+
+struct Transition {
+  State from;
+  Guard guard;
+  State to;
+};
+
+// Everything a state action or guard may look at during one tick
+struct Context {
+  int32_t i;
+  int32_t j;
+  uint64_t time;
+  float grass[9];
+  float rain;
+  float battery;
+  float batteryThreshold;
+  Thresholds const &thresholds;
+  int32_t &lastcut_i;
+  int32_t &lastcut_j;
+  LawnMap &lawnMap;
+  Navigation &navigation;
+};
+
+inline int transientCut(LawnMap const &lawnMap, Navigation &navigation, int32_t searchRange, int32_t i, int32_t j, uint64_t time, float grassCentre, float transientCutGrassThreshold) {
+  // Stay and cut if too long
+  if (grassCentre > transientCutGrassThreshold) {
+    return MOVE_STAY;
+  }
+  // Head for the tallest grass remembered nearby if it is worth cutting
+  int32_t tallest_i {i};
+  int32_t tallest_j {j};
+  float tallestHeight {0.0f};
+  if (lawnMap.FindTallest(i, j, searchRange, time, tallest_i, tallest_j, tallestHeight)
+      && tallestHeight > transientCutGrassThreshold && (tallest_i != i || tallest_j != j)) {
+    return navigation.GetMove(i, j, tallest_i, tallest_j);
+  }
+  // Otherwise move in the default general direction, sliding right along a
+  // wall the lawn map knows of right below
+  if (j + 1 < static_cast<int32_t>(LawnMap::GRID_SIZE) && lawnMap.IsWall(i, j + 1)) {
+    return MOVE_RIGHT;
+  }
+  if (j < SWEEP_TURN_ROW) {
+    // Random chance to deviate from the general direction
+    if (std::rand() % 4 <= 1) {
+      return MOVE_RIGHT;
+    }
+    else if (std::rand() % 4 == 2) {
+      return MOVE_BOTTOM_CENTRE;
+    }
+    else {
+      return MOVE_BOTTOM_RIGHT; // Ideal general direction
+    }
+  }
+
+    // Random chance to deviate from the general direction
+    if (std::rand() % 3 == 0) {
+      return MOVE_BOTTOM_CENTRE;
+    }
+    else if (std::rand() % 3 == 1) {
+      return MOVE_LEFT;
+    }
+    else {
+      return MOVE_BOTTOM_LEFT; // Ideal general direction
+    }
+}
+
+inline int stationaryCut(float grassTopLeft, float grassTopCentre, float grassTopRight, float grassRight, float grassBottomRight, float grassBottomCentre, float grassBottomLeft, float grassLeft) {
+
+  float maxGrassHeight = 0.0;
+  int maxGrassDir = MOVE_STAY;
+
+  // Find the maximum grass and go to that direction
+  if (grassTopLeft > maxGrassHeight) {
+    maxGrassHeight = grassTopLeft;
+    maxGrassDir = MOVE_TOP_LEFT;
+  }
+  if (grassTopCentre > maxGrassHeight) {
+    maxGrassHeight = grassTopCentre;
+    maxGrassDir = MOVE_TOP_CENTRE;
+  }
+  if (grassTopRight > maxGrassHeight) {
+    maxGrassHeight = grassTopRight;
+    maxGrassDir = MOVE_TOP_RIGHT;
+  }
+  if (grassRight > maxGrassHeight) {
+    maxGrassHeight = grassRight;
+    maxGrassDir = MOVE_RIGHT;
+  }
+  if (grassBottomRight > maxGrassHeight) {
+    maxGrassHeight = grassBottomRight;
+    maxGrassDir = MOVE_BOTTOM_RIGHT;
+  }
+  if (grassBottomCentre > maxGrassHeight) {
+    maxGrassHeight = grassBottomCentre;
+    maxGrassDir = MOVE_BOTTOM_CENTRE;
+  }
+  if (grassBottomLeft > maxGrassHeight) {
+    maxGrassHeight = grassBottomLeft;
+    maxGrassDir = MOVE_BOTTOM_LEFT;
+  }
+  if (grassLeft > maxGrassHeight) {
+    maxGrassHeight = grassLeft;
+    maxGrassDir = MOVE_LEFT;
+  }
+  return maxGrassDir;
+}
+
+inline int returnToLastCut(Navigation &navigation, int32_t i, int32_t j, int32_t lastcut_i, int32_t lastcut_j) {
+  // Shortest path around the known walls, looked up from a precomputed table
+  return navigation.GetMove(i, j, lastcut_i, lastcut_j);
+}
+
+inline int returnToCharge(Navigation &navigation, int32_t i, int32_t j) {
+  // Shortest path around the known walls, looked up from a precomputed table
+  return navigation.GetMoveToCharge(i, j);
+}
+
+// Rows are tried in order and the first row for the current state whose guard
+// holds decides the next state; with no matching row the state is kept.
+constexpr Transition HEURISTIC_TRANSITIONS[] = {
+  {TRANSIENT_CUT, BATTERY_LOW, STORE_LASTCUT},
+  {TRANSIENT_CUT, GRASS_TALL_AND_DRY, STATIONARY_CUT},
+  {STORE_LASTCUT, ALWAYS, RETURN_TO_CHARGE},
+  {RETURN_TO_CHARGE, AT_CHARGER, STAY_AND_CHARGE},
+  {STATIONARY_CUT, BATTERY_LOW, STORE_LASTCUT},
+  {STATIONARY_CUT, ALWAYS, TRANSIENT_CUT},
+  {STAY_AND_CHARGE, BATTERY_FULL, RETURN_TO_LASTCUT},
+  {RETURN_TO_LASTCUT, AT_LASTCUT, STATIONARY_CUT},
+  {RETURN_TO_LASTCUT, GRASS_TALL, STATIONARY_CUT}
+};
+
+// Checked at compile time so that a state cannot be left out of a table by
+// mistake.
+constexpr bool hasTransitionFrom(Transition const *table, uint32_t count,
+    State state)
+{
+  for (uint32_t k{0}; k < count; k++) {
+    if (table[k].from == state) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <State S> struct HeuristicAction;
+
+template <> struct HeuristicAction<TRANSIENT_CUT> {
+  static int Run(Context &c) {
+    return transientCut(c.lawnMap, c.navigation, LAWNMAP_SEARCH_RANGE, c.i, c.j, c.time, c.grass[4], c.thresholds.transientCutGrass);
+  }
+};
+
+template <> struct HeuristicAction<STATIONARY_CUT> {
+  static int Run(Context &c) {
+    return stationaryCut(c.grass[0], c.grass[1], c.grass[2], c.grass[5], c.grass[8], c.grass[7], c.grass[6], c.grass[3]);
+  }
+};
+
+template <> struct HeuristicAction<STORE_LASTCUT> {
+  static int Run(Context &c) {
+    c.lastcut_i = c.i;
+    c.lastcut_j = c.j;
+    return returnToCharge(c.navigation, c.i, c.j);
+  }
+};
+
+template <> struct HeuristicAction<RETURN_TO_CHARGE> {
+  static int Run(Context &c) {
+    return returnToCharge(c.navigation, c.i, c.j);
+  }
+};
+
+template <> struct HeuristicAction<STAY_AND_CHARGE> {
+  static int Run(Context &) {
+    return MOVE_STAY;
+  }
+};
+
+template <> struct HeuristicAction<RETURN_TO_LASTCUT> {
+  static int Run(Context &c) {
+    return returnToLastCut(c.navigation, c.i, c.j, c.lastcut_i, c.lastcut_j);
+  }
+};
+
+template <> struct HeuristicAction<ERROR> {
+  static int Run(Context &) {
+    return MOVE_STAY;
+  }
+};
+
+// The default controller: cut where the grass is tall, using the lawn map to
+// find it, and return to charge on a per-quadrant battery threshold.
+struct HeuristicPolicy {
+  static constexpr State INITIAL_STATE = STATIONARY_CUT;
+  static constexpr Transition const *TRANSITIONS = HEURISTIC_TRANSITIONS;
+  static constexpr uint32_t TRANSITION_COUNT =
+    sizeof(HEURISTIC_TRANSITIONS) / sizeof(Transition);
+
+  template <State S> using Action = HeuristicAction<S>;
+};
+
+// As HeuristicPolicy, but transient cutting ignores the lawn map and only
+// follows the sweep pattern.
+template <State S> struct SweepAction : HeuristicAction<S> {};
+
+template <> struct SweepAction<TRANSIENT_CUT> {
+  static int Run(Context &c) {
+    return transientCut(c.lawnMap, c.navigation, 0, c.i, c.j, c.time, c.grass[4], c.thresholds.transientCutGrass);
+  }
+};
+
+struct SweepPolicy : HeuristicPolicy {
+  template <State S> using Action = SweepAction<S>;
+};
+
+// Runs the state machine described by Policy. A policy provides
+// INITIAL_STATE, a constexpr transition table (TRANSITIONS,
+// TRANSITION_COUNT) and an Action<S> with a static Run(Context &) per state.
+// Everything is resolved at compile time, so each policy is its own
+// controller type without any virtual calls.
+template <typename Policy>
+class Controller {
+  public:
+    Controller(Thresholds const &, LawnMap &, Navigation &);
+    virtual ~Controller();
+    float GetBatteryThreshold() const;
+    int32_t GetLastCutI() const;
+    int32_t GetLastCutJ() const;
+    State GetState() const;
+    template <typename T> int Step(T const &);
+
+  private:
+    Controller(Controller const &);
+    Controller &operator=(Controller const &);
+    int Act(Context &) const;
+    float GetBatteryThresholdAt(int32_t, int32_t) const;
+    bool IsGuardMet(Guard, Context const &) const;
+    State Next(Context const &) const;
+
+    Thresholds const m_thresholds;
+    LawnMap &m_lawn_map;
+    Navigation &m_navigation;
+    State m_state;
+    float m_battery_threshold;
+    int32_t m_lastcut_i;
+    int32_t m_lastcut_j;
+    uint64_t m_last_time;
+    float m_last_battery;
+    int32_t m_last_i;
+    int32_t m_last_j;
+    int m_last_command;
+
+    static_assert(hasTransitionFrom(Policy::TRANSITIONS, Policy::TRANSITION_COUNT, TRANSIENT_CUT)
+        && hasTransitionFrom(Policy::TRANSITIONS, Policy::TRANSITION_COUNT, STATIONARY_CUT)
+        && hasTransitionFrom(Policy::TRANSITIONS, Policy::TRANSITION_COUNT, STORE_LASTCUT)
+        && hasTransitionFrom(Policy::TRANSITIONS, Policy::TRANSITION_COUNT, RETURN_TO_CHARGE)
+        && hasTransitionFrom(Policy::TRANSITIONS, Policy::TRANSITION_COUNT, STAY_AND_CHARGE)
+        && hasTransitionFrom(Policy::TRANSITIONS, Policy::TRANSITION_COUNT, RETURN_TO_LASTCUT),
+        "Every working state needs a way out in the transition table.");
+};
+
+template <typename Policy>
+inline Controller<Policy>::Controller(Thresholds const &thresholds,
+    LawnMap &lawnMap, Navigation &navigation):
+  m_thresholds(thresholds),
+  m_lawn_map(lawnMap),
+  m_navigation(navigation),
+  m_state(Policy::INITIAL_STATE),
+  m_battery_threshold(thresholds.batteryDrainQ1),
+  m_lastcut_i(-1),
+  m_lastcut_j(-1),
+  m_last_time(0),
+  m_last_battery(0.0f),
+  m_last_i(0),
+  m_last_j(0),
+  m_last_command(MOVE_STAY)
+{
+}
+
+template <typename Policy>
+inline Controller<Policy>::~Controller()
+{
+}
+
+template <typename Policy>
+inline int Controller<Policy>::Act(Context &c) const
+{
+  switch (m_state) {
+    case TRANSIENT_CUT:
+      return Policy::template Action<TRANSIENT_CUT>::Run(c);
+    case STATIONARY_CUT:
+      return Policy::template Action<STATIONARY_CUT>::Run(c);
+    case STORE_LASTCUT:
+      return Policy::template Action<STORE_LASTCUT>::Run(c);
+    case RETURN_TO_CHARGE:
+      return Policy::template Action<RETURN_TO_CHARGE>::Run(c);
+    case STAY_AND_CHARGE:
+      return Policy::template Action<STAY_AND_CHARGE>::Run(c);
+    case RETURN_TO_LASTCUT:
+      return Policy::template Action<RETURN_TO_LASTCUT>::Run(c);
+    default:
+      return Policy::template Action<ERROR>::Run(c);
+  }
+}
+
+template <typename Policy>
+inline float Controller<Policy>::GetBatteryThreshold() const
+{
+  return m_battery_threshold;
+}
+
+// Determine which quadrant the battery threshold is
+template <typename Policy>
+inline float Controller<Policy>::GetBatteryThresholdAt(int32_t i,
+    int32_t j) const
+{
+  if (0 <= i && i <= 23 && 0 <= j && j <= 17) {
+    return m_thresholds.batteryDrainQ1;
+  }
+  else if (i > 23 && j <= 17) {
+    return m_thresholds.batteryDrainQ2;
+  }
+  else if (j > 17 && i > 23) {
+    return m_thresholds.batteryDrainQ3;
+  }
+  else {
+    return m_thresholds.batteryDrainQ4;
+  }
+}
+
+template <typename Policy>
+inline int32_t Controller<Policy>::GetLastCutI() const
+{
+  return m_lastcut_i;
+}
+
+template <typename Policy>
+inline int32_t Controller<Policy>::GetLastCutJ() const
+{
+  return m_lastcut_j;
+}
+
+template <typename Policy>
+inline State Controller<Policy>::GetState() const
+{
+  return m_state;
+}
+
+template <typename Policy>
+inline bool Controller<Policy>::IsGuardMet(Guard guard,
+    Context const &c) const
+{
+  switch (guard) {
+    case ALWAYS:
+      return true;
+    case BATTERY_LOW:
+      return c.battery < c.batteryThreshold;
+    case BATTERY_FULL:
+      return c.battery >= m_thresholds.batteryFull;
+    case AT_CHARGER:
+      return c.i == 0 && c.j == 0;
+    case AT_LASTCUT:
+      return c.i == c.lastcut_i && c.j == c.lastcut_j;
+    case GRASS_TALL:
+      return c.grass[4] > m_thresholds.transientCutGrass;
+    case GRASS_TALL_AND_DRY:
+      return c.grass[4] > m_thresholds.transientCutGrass
+        && c.rain < m_thresholds.rainAvoidance;
+    default:
+      return false;
+  }
+}
+
+template <typename Policy>
+inline State Controller<Policy>::Next(Context const &c) const
+{
+  for (uint32_t k{0}; k < Policy::TRANSITION_COUNT; k++) {
+    Transition const &transition = Policy::TRANSITIONS[k];
+    if (transition.from == m_state && IsGuardMet(transition.guard, c)) {
+      return transition.to;
+    }
+  }
+  return m_state;
+}
+
+// Takes one Sensors message (tme290::grass::Sensors or
+// tme290::od4::SensorsView), returns the command to send and moves the state
+// machine on.
+template <typename Policy>
+template <typename T>
+inline int Controller<Policy>::Step(T const &sensors)
+{
+  m_lawn_map.Update(sensors);
+
+  int32_t const i = static_cast<int32_t>(sensors.i());
+  int32_t const j = static_cast<int32_t>(sensors.j());
+
+  // A move that left the mower where it was, with battery to spare, ran into
+  // a wall the sensors did not report. Marking it makes the navigation
+  // fields route around it from now on.
+  if (m_last_command != MOVE_STAY && sensors.time() > m_last_time
+      && m_last_battery > 0.0f && i == m_last_i && j == m_last_j) {
+    m_lawn_map.SetWall(i + NAVIGATION_DI[m_last_command],
+        j + NAVIGATION_DJ[m_last_command]);
+  }
+
+  m_battery_threshold = GetBatteryThresholdAt(i, j);
+
+  Context c{i, j, sensors.time(),
+    {sensors.grassTopLeft(), sensors.grassTopCentre(), sensors.grassTopRight(),
+      sensors.grassLeft(), sensors.grassCentre(), sensors.grassRight(),
+      sensors.grassBottomLeft(), sensors.grassBottomCentre(),
+      sensors.grassBottomRight()},
+    sensors.rain(), sensors.battery(), m_battery_threshold, m_thresholds,
+    m_lastcut_i, m_lastcut_j, m_lawn_map, m_navigation};
+
+  int const command = Act(c);
+  m_state = Next(c);
+  m_last_time = sensors.time();
+  m_last_battery = sensors.battery();
+  m_last_i = i;
+  m_last_j = j;
+  m_last_command = (command > MOVE_STAY && command <= MOVE_LEFT)
+    ? command : MOVE_STAY;
+  return command;
+}
+
+}
+}
+
+#endif
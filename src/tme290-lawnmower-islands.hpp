@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_ISLANDS_HPP
+#define TME290_LAWNMOWER_ISLANDS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cluon-complete.hpp"
+#include "tinyso.hpp"
+
+namespace tme290 {
+namespace lawnmower {
+
+// Which islands an island takes migrants from: its predecessor (RING), every
+// other island (FULL), or one other island drawn at random each time
+// (RANDOM).
+enum Topology { RING, FULL, RANDOM };
+
+// Migration between trainer processes on the same host. Every island owns a
+// shared memory segment, named after the group and its index, in which it
+// publishes its latest emigrants, and reads the segments of the islands it
+// takes migrants from. There is no coordinator: an island that has not
+// started yet, or has already stopped, is simply skipped, and migrants that
+// have already been taken in are not taken again.
+class IslandExchange {
+  public:
+    IslandExchange(std::string const &, uint32_t const, uint32_t const,
+        Topology const, uint32_t const, uint32_t const);
+    virtual ~IslandExchange();
+    uint64_t GetImmigrantCount() const;
+    std::pair<tinyso::Population, tinyso::Fitnesses> Migrate(
+        tinyso::Population const &, tinyso::Fitnesses const &);
+
+  private:
+    IslandExchange(IslandExchange const &);
+    IslandExchange &operator=(IslandExchange const &);
+
+    // Start of every segment, followed by count records of one fitness and
+    // length genes.
+    struct Header {
+      char magic[8];
+      uint64_t sequence;
+      uint32_t count;
+      uint32_t length;
+    };
+
+    struct Source {
+      uint32_t island{0};
+      std::unique_ptr<cluon::SharedMemory> memory{};
+      uint64_t sequence{0};
+    };
+
+    std::string GetName(uint32_t const) const;
+    void Publish(tinyso::Population const &, tinyso::Fitnesses const &);
+    void Read(Source &, tinyso::Population &, tinyso::Fitnesses &);
+
+    std::string const m_group;
+    std::unique_ptr<cluon::SharedMemory> m_memory;
+    std::vector<Source> m_sources;
+    std::mt19937 m_generator;
+    uint64_t m_immigrant_count;
+    uint64_t m_sequence;
+    uint32_t const m_capacity;
+    uint32_t const m_length;
+    Topology const m_topology;
+};
+
+namespace {
+char const ISLAND_MAGIC[8] = {'T', 'M', 'E', 'I', 'S', 'L', 'E', '1'};
+}
+
+inline IslandExchange::IslandExchange(std::string const &group,
+    uint32_t const island, uint32_t const island_count,
+    Topology const topology, uint32_t const capacity, uint32_t const length):
+  m_group(group),
+  m_memory(),
+  m_sources(),
+  m_generator(island),
+  m_immigrant_count(0),
+  m_sequence(0),
+  m_capacity(capacity),
+  m_length(length),
+  m_topology(topology)
+{
+  uint32_t const size = static_cast<uint32_t>(sizeof(Header)
+      + capacity * (1 + length) * sizeof(double));
+  m_memory.reset(new cluon::SharedMemory(GetName(island), size));
+  if (m_memory->valid()) {
+    m_memory->lock();
+    std::memset(m_memory->data(), 0, m_memory->size());
+    m_memory->unlock();
+  }
+
+  if (island_count > 1) {
+    if (topology == RING) {
+      Source source;
+      source.island = (island + island_count - 1) % island_count;
+      m_sources.push_back(std::move(source));
+    } else {
+      for (uint32_t i{0}; i < island_count; i++) {
+        if (i != island) {
+          Source source;
+          source.island = i;
+          m_sources.push_back(std::move(source));
+        }
+      }
+    }
+  }
+}
+
+inline IslandExchange::~IslandExchange()
+{
+}
+
+inline uint64_t IslandExchange::GetImmigrantCount() const
+{
+  return m_immigrant_count;
+}
+
+inline std::string IslandExchange::GetName(uint32_t const island) const
+{
+  return m_group + "-island-" + std::to_string(island);
+}
+
+// Publishes the emigrants and returns the migrants that have arrived from
+// the source islands since the last call.
+inline std::pair<tinyso::Population, tinyso::Fitnesses>
+  IslandExchange::Migrate(tinyso::Population const &emigrants,
+      tinyso::Fitnesses const &fitnesses)
+{
+  Publish(emigrants, fitnesses);
+
+  std::pair<tinyso::Population, tinyso::Fitnesses> immigrants;
+  if (m_sources.empty()) {
+    return immigrants;
+  }
+  if (m_topology == RANDOM) {
+    std::uniform_int_distribution<uint32_t> dist(0,
+        static_cast<uint32_t>(m_sources.size()) - 1);
+    Read(m_sources[dist(m_generator)], immigrants.first, immigrants.second);
+  } else {
+    for (auto &source : m_sources) {
+      Read(source, immigrants.first, immigrants.second);
+    }
+  }
+  m_immigrant_count += immigrants.first.size();
+  return immigrants;
+}
+
+inline void IslandExchange::Publish(tinyso::Population const &emigrants,
+    tinyso::Fitnesses const &fitnesses)
+{
+  if (!m_memory->valid()) {
+    return;
+  }
+
+  Header header;
+  std::memcpy(header.magic, ISLAND_MAGIC, sizeof(header.magic));
+  header.sequence = ++m_sequence;
+  header.count = std::min(m_capacity,
+      static_cast<uint32_t>(emigrants.size()));
+  header.length = m_length;
+
+  m_memory->lock();
+  char *data = m_memory->data();
+  double *records = reinterpret_cast<double *>(data + sizeof(Header));
+  for (uint32_t k{0}; k < header.count; k++) {
+    records[0] = fitnesses[k];
+    std::memcpy(records + 1, emigrants[k].data(), m_length * sizeof(double));
+    records += 1 + m_length;
+  }
+  std::memcpy(data, &header, sizeof(Header));
+  m_memory->unlock();
+}
+
+// Attaches to the source's segment the first time it exists, and takes its
+// migrants if they are newer than the last ones taken. A restarted island
+// creates its segment anew, while a reader still attached to the old one
+// would see it frozen forever, so a segment that has not changed since the
+// last read is let go and attached again on the next. A restarted island
+// counts its sequence from the start, which is taken as new as well.
+inline void IslandExchange::Read(Source &source,
+    tinyso::Population &immigrants, tinyso::Fitnesses &fitnesses)
+{
+  if (!source.memory || !source.memory->valid()) {
+    source.memory.reset(new cluon::SharedMemory(GetName(source.island)));
+    if (!source.memory->valid()) {
+      return;
+    }
+  }
+
+  source.memory->lock();
+  char const *data = source.memory->data();
+  Header header;
+  std::memcpy(&header, data, sizeof(Header));
+  bool const isNew = std::memcmp(header.magic, ISLAND_MAGIC,
+      sizeof(header.magic)) == 0 && header.sequence != source.sequence
+    && header.length == m_length && sizeof(Header) + header.count
+    * (1 + m_length) * sizeof(double) <= source.memory->size();
+  if (isNew) {
+    double const *records = reinterpret_cast<double const *>(
+        data + sizeof(Header));
+    for (uint32_t k{0}; k < header.count; k++) {
+      fitnesses.push_back(records[0]);
+      immigrants.push_back(tinyso::Individual(records + 1,
+            records + 1 + m_length));
+      records += 1 + m_length;
+    }
+    source.sequence = header.sequence;
+  }
+  source.memory->unlock();
+  if (!isNew) {
+    source.memory.reset();
+  }
+}
+
+}
+}
+
+#endif
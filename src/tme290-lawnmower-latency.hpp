@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_LATENCY_HPP
+#define TME290_LAWNMOWER_LATENCY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tme290 {
+namespace lawnmower {
+
+// Histogram of durations in nanoseconds with a fixed relative precision, in
+// the manner of HdrHistogram. Values below 2^SUB_BUCKET_BITS are counted
+// exactly; above that every power of two is split into 2^(SUB_BUCKET_BITS-1)
+// equally wide buckets, so a recorded value is off by less than 1/64. Counts
+// are atomics, which lets one thread record while another reads.
+class LatencyHistogram {
+  public:
+    static uint32_t const SUB_BUCKET_BITS = 7;
+    static uint32_t const SUB_BUCKET_HALF = 1 << (SUB_BUCKET_BITS - 1);
+    static uint32_t const BUCKET_COUNT =
+      (64 - SUB_BUCKET_BITS + 2) * SUB_BUCKET_HALF;
+
+    LatencyHistogram();
+    virtual ~LatencyHistogram();
+    uint64_t GetCount() const;
+    uint64_t GetMax() const;
+    double GetMean() const;
+    uint64_t GetMin() const;
+    uint64_t GetValueAtPercentile(double) const;
+    void Record(uint64_t);
+
+  private:
+    LatencyHistogram(LatencyHistogram const &);
+    LatencyHistogram &operator=(LatencyHistogram const &);
+    static uint32_t GetIndex(uint64_t);
+    static uint64_t GetHighestValue(uint32_t);
+
+    std::vector<std::atomic<uint64_t>> m_counts;
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_min;
+    std::atomic<uint64_t> m_max;
+};
+
+inline LatencyHistogram::LatencyHistogram():
+  m_counts(BUCKET_COUNT),
+  m_count(0),
+  m_sum(0),
+  m_min(UINT64_MAX),
+  m_max(0)
+{
+  for (auto &count : m_counts) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+inline LatencyHistogram::~LatencyHistogram()
+{
+}
+
+inline uint64_t LatencyHistogram::GetCount() const
+{
+  return m_count.load(std::memory_order_relaxed);
+}
+
+// Largest value that falls into the given bucket.
+inline uint64_t LatencyHistogram::GetHighestValue(uint32_t index)
+{
+  if (index < 2 * SUB_BUCKET_HALF) {
+    return index;
+  }
+  uint32_t const exponent = index / SUB_BUCKET_HALF - 1;
+  uint64_t const mantissa = index - exponent * SUB_BUCKET_HALF;
+  return ((mantissa + 1) << exponent) - 1;
+}
+
+inline uint32_t LatencyHistogram::GetIndex(uint64_t value)
+{
+  if (value < 2 * SUB_BUCKET_HALF) {
+    return static_cast<uint32_t>(value);
+  }
+  uint32_t const msb = 63 - static_cast<uint32_t>(__builtin_clzll(value));
+  uint32_t const exponent = msb - SUB_BUCKET_BITS + 1;
+  return exponent * SUB_BUCKET_HALF + static_cast<uint32_t>(value >> exponent);
+}
+
+inline uint64_t LatencyHistogram::GetMax() const
+{
+  return m_max.load(std::memory_order_relaxed);
+}
+
+inline double LatencyHistogram::GetMean() const
+{
+  uint64_t const count = GetCount();
+  if (count == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(m_sum.load(std::memory_order_relaxed))
+    / static_cast<double>(count);
+}
+
+inline uint64_t LatencyHistogram::GetMin() const
+{
+  uint64_t const min = m_min.load(std::memory_order_relaxed);
+  return (min == UINT64_MAX) ? 0 : min;
+}
+
+// Smallest bucket value at or above the given percentile (0-100), capped by
+// the largest recorded value.
+inline uint64_t LatencyHistogram::GetValueAtPercentile(double percentile) const
+{
+  uint64_t const count = GetCount();
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t target = static_cast<uint64_t>(percentile / 100.0
+      * static_cast<double>(count) + 0.5);
+  target = std::max<uint64_t>(1, std::min(target, count));
+
+  uint64_t seen{0};
+  for (uint32_t index{0}; index < BUCKET_COUNT; index++) {
+    seen += m_counts[index].load(std::memory_order_relaxed);
+    if (seen >= target) {
+      return std::min(GetHighestValue(index), GetMax());
+    }
+  }
+  return GetMax();
+}
+
+inline void LatencyHistogram::Record(uint64_t value)
+{
+  m_counts[GetIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sum.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t min = m_min.load(std::memory_order_relaxed);
+  while (value < min && !m_min.compare_exchange_weak(min, value,
+        std::memory_order_relaxed)) {
+  }
+  uint64_t max = m_max.load(std::memory_order_relaxed);
+  while (value > max && !m_max.compare_exchange_weak(max, value,
+        std::memory_order_relaxed)) {
+  }
+}
+
+// Latency of one Sensors message through the controller. Receive is the
+// kernel timestamp of the datagram (SIOCGSTAMP, as stored by the session), so
+// all stages are measured on the system clock.
+class LatencyRecorder {
+  public:
+    enum Stage { RECEIVE_TO_DECODE, DECODE_TO_DECIDE, DECIDE_TO_SEND,
+      RECEIVE_TO_SEND, STAGE_COUNT };
+
+    LatencyRecorder(bool const);
+    virtual ~LatencyRecorder();
+    LatencyHistogram const &GetHistogram(Stage const) const;
+    void Print(std::ostream &) const;
+    void Record(std::chrono::system_clock::time_point const &,
+        std::chrono::system_clock::time_point const &,
+        std::chrono::system_clock::time_point const &,
+        std::chrono::system_clock::time_point const &);
+
+  private:
+    LatencyRecorder(LatencyRecorder const &);
+    LatencyRecorder &operator=(LatencyRecorder const &);
+    static uint64_t GetNanoseconds(std::chrono::system_clock::time_point const &,
+        std::chrono::system_clock::time_point const &);
+    static void PrintHistogram(std::ostream &, std::string const &,
+        LatencyHistogram const &);
+
+    LatencyHistogram m_histograms[STAGE_COUNT];
+    bool const m_per_stage;
+};
+
+inline LatencyRecorder::LatencyRecorder(bool const per_stage):
+  m_histograms(),
+  m_per_stage(per_stage)
+{
+}
+
+inline LatencyRecorder::~LatencyRecorder()
+{
+}
+
+inline LatencyHistogram const &LatencyRecorder::GetHistogram(
+    Stage const stage) const
+{
+  return m_histograms[stage];
+}
+
+// The system clock may be stepped, a negative duration is counted as zero.
+inline uint64_t LatencyRecorder::GetNanoseconds(
+    std::chrono::system_clock::time_point const &from,
+    std::chrono::system_clock::time_point const &to)
+{
+  int64_t const nanoseconds = std::chrono::duration_cast<
+    std::chrono::nanoseconds>(to - from).count();
+  return (nanoseconds > 0) ? static_cast<uint64_t>(nanoseconds) : 0;
+}
+
+inline void LatencyRecorder::Print(std::ostream &out) const
+{
+  out << "Latency in microseconds:" << std::endl;
+  PrintHistogram(out, "receive-send", m_histograms[RECEIVE_TO_SEND]);
+  if (m_per_stage) {
+    PrintHistogram(out, "receive-decode", m_histograms[RECEIVE_TO_DECODE]);
+    PrintHistogram(out, "decode-decide", m_histograms[DECODE_TO_DECIDE]);
+    PrintHistogram(out, "decide-send", m_histograms[DECIDE_TO_SEND]);
+  }
+}
+
+inline void LatencyRecorder::PrintHistogram(std::ostream &out,
+    std::string const &name, LatencyHistogram const &histogram)
+{
+  auto microseconds = [](uint64_t nanoseconds) {
+    return static_cast<double>(nanoseconds) / 1000.0;
+  };
+  out << "  " << std::left << std::setw(15) << name << std::right
+    << std::fixed << std::setprecision(1)
+    << " n=" << histogram.GetCount()
+    << " min=" << microseconds(histogram.GetMin())
+    << " mean=" << histogram.GetMean() / 1000.0
+    << " p50=" << microseconds(histogram.GetValueAtPercentile(50.0))
+    << " p90=" << microseconds(histogram.GetValueAtPercentile(90.0))
+    << " p99=" << microseconds(histogram.GetValueAtPercentile(99.0))
+    << " p99.9=" << microseconds(histogram.GetValueAtPercentile(99.9))
+    << " max=" << microseconds(histogram.GetMax())
+    << std::defaultfloat << std::endl;
+}
+
+inline void LatencyRecorder::Record(
+    std::chrono::system_clock::time_point const &received,
+    std::chrono::system_clock::time_point const &decoded,
+    std::chrono::system_clock::time_point const &decided,
+    std::chrono::system_clock::time_point const &sent)
+{
+  m_histograms[RECEIVE_TO_SEND].Record(GetNanoseconds(received, sent));
+  if (m_per_stage) {
+    m_histograms[RECEIVE_TO_DECODE].Record(GetNanoseconds(received, decoded));
+    m_histograms[DECODE_TO_DECIDE].Record(GetNanoseconds(decoded, decided));
+    m_histograms[DECIDE_TO_SEND].Record(GetNanoseconds(decided, sent));
+  }
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_LAWNMAP_HPP
+#define TME290_LAWNMOWER_LAWNMAP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "tme290-sim-grass.hpp"
+
+namespace tme290 {
+namespace lawnmower {
+
+// What the mower has seen of the lawn so far. Every Sensors message updates
+// the 3x3 cells around the mower with their height and observation time, and
+// a per-cell growth rate is estimated from consecutive observations in which
+// the grass got taller. Heights, rates and times are kept in separate flat
+// arrays so that area queries only touch the data they need. Time going
+// backwards means the simulator was restarted, and everything but the walls
+// is then forgotten.
+class LawnMap {
+  public:
+    static uint32_t const GRID_SIZE = tme290::grass::Simulator::GRID_SIZE;
+    static uint64_t const NEVER = 0xffffffffffffffff;
+
+    LawnMap(float const = 0.0005f, float const = 0.2f);
+    virtual ~LawnMap();
+    bool FindTallest(int32_t, int32_t, int32_t, uint64_t, int32_t &,
+        int32_t &, float &) const;
+    float GetGrowthRate(int32_t, int32_t) const;
+    float GetHeight(int32_t, int32_t, uint64_t) const;
+    uint64_t GetLastSeen(int32_t, int32_t) const;
+    uint32_t GetWallCount() const;
+    bool IsWall(int32_t, int32_t) const;
+    void SetWall(int32_t, int32_t);
+    template <typename T> void Update(T const &);
+
+  private:
+    void Clear();
+    static uint32_t GetCell(int32_t, int32_t);
+    static bool IsInside(int32_t, int32_t);
+    void Observe(int32_t, int32_t, float, uint64_t);
+
+    std::vector<float> m_height;
+    std::vector<float> m_rate;
+    std::vector<uint64_t> m_last_seen;
+    std::vector<uint8_t> m_wall;
+    uint64_t m_time;
+    uint32_t m_wall_count;
+    float const m_initial_rate;
+    float const m_rate_filter;
+};
+
+inline LawnMap::LawnMap(float const initial_rate, float const rate_filter):
+  m_height(GRID_SIZE * GRID_SIZE, 0.0f),
+  m_rate(GRID_SIZE * GRID_SIZE, initial_rate),
+  m_last_seen(GRID_SIZE * GRID_SIZE, static_cast<uint64_t>(NEVER)),
+  m_wall(GRID_SIZE * GRID_SIZE, 0),
+  m_time(0),
+  m_wall_count(0),
+  m_initial_rate(initial_rate),
+  m_rate_filter(rate_filter)
+{
+}
+
+inline LawnMap::~LawnMap()
+{
+}
+
+inline void LawnMap::Clear()
+{
+  std::fill(m_height.begin(), m_height.end(), 0.0f);
+  std::fill(m_rate.begin(), m_rate.end(), m_initial_rate);
+  std::fill(m_last_seen.begin(), m_last_seen.end(),
+      static_cast<uint64_t>(NEVER));
+}
+
+// Finds the observed cell with the tallest predicted grass within k steps
+// (8-connected, ignoring walls) of (i, j) at the given time. Returns false if
+// no cell in range has been observed.
+inline bool LawnMap::FindTallest(int32_t i, int32_t j, int32_t k,
+    uint64_t time, int32_t &tallest_i, int32_t &tallest_j,
+    float &tallest_height) const
+{
+  int32_t const size = static_cast<int32_t>(GRID_SIZE);
+  int32_t const i_min = std::max(0, i - k);
+  int32_t const i_max = std::min(size - 1, i + k);
+  int32_t const j_min = std::max(0, j - k);
+  int32_t const j_max = std::min(size - 1, j + k);
+
+  bool found{false};
+  tallest_height = -1.0f;
+  for (int32_t y{j_min}; y <= j_max; y++) {
+    uint32_t const row = static_cast<uint32_t>(y) * GRID_SIZE;
+    for (int32_t x{i_min}; x <= i_max; x++) {
+      uint32_t const cell = row + static_cast<uint32_t>(x);
+      if (m_last_seen[cell] == NEVER || m_wall[cell]) {
+        continue;
+      }
+      float const age = (time > m_last_seen[cell])
+        ? static_cast<float>(time - m_last_seen[cell]) : 0.0f;
+      float const height = std::min(1.0f, m_height[cell] + m_rate[cell] * age);
+      if (height > tallest_height) {
+        tallest_height = height;
+        tallest_i = x;
+        tallest_j = y;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+inline uint32_t LawnMap::GetCell(int32_t i, int32_t j)
+{
+  return static_cast<uint32_t>(j) * GRID_SIZE + static_cast<uint32_t>(i);
+}
+
+inline float LawnMap::GetGrowthRate(int32_t i, int32_t j) const
+{
+  return IsInside(i, j) ? m_rate[GetCell(i, j)] : 0.0f;
+}
+
+// Predicted height at the given time, or -1 for walls and unseen cells.
+inline float LawnMap::GetHeight(int32_t i, int32_t j, uint64_t time) const
+{
+  if (!IsInside(i, j)) {
+    return -1.0f;
+  }
+  uint32_t const cell = GetCell(i, j);
+  if (m_last_seen[cell] == NEVER || m_wall[cell]) {
+    return -1.0f;
+  }
+  float const age = (time > m_last_seen[cell])
+    ? static_cast<float>(time - m_last_seen[cell]) : 0.0f;
+  return std::min(1.0f, m_height[cell] + m_rate[cell] * age);
+}
+
+inline uint64_t LawnMap::GetLastSeen(int32_t i, int32_t j) const
+{
+  return IsInside(i, j) ? m_last_seen[GetCell(i, j)] : NEVER;
+}
+
+inline uint32_t LawnMap::GetWallCount() const
+{
+  return m_wall_count;
+}
+
+inline bool LawnMap::IsInside(int32_t i, int32_t j)
+{
+  int32_t const size = static_cast<int32_t>(GRID_SIZE);
+  return i >= 0 && j >= 0 && i < size && j < size;
+}
+
+inline bool LawnMap::IsWall(int32_t i, int32_t j) const
+{
+  return !IsInside(i, j) || m_wall[GetCell(i, j)] != 0;
+}
+
+inline void LawnMap::Observe(int32_t i, int32_t j, float height,
+    uint64_t time)
+{
+  if (!IsInside(i, j)) {
+    return;
+  }
+  uint32_t const cell = GetCell(i, j);
+  if (height < 0.0f) {
+    SetWall(i, j);
+    return;
+  }
+
+  // Only growth between two observations says anything about the rate, a
+  // drop means the cell was cut in between.
+  uint64_t const last_seen = m_last_seen[cell];
+  if (last_seen != NEVER && time > last_seen && height > m_height[cell]
+      && height < 1.0f) {
+    float const rate = (height - m_height[cell])
+      / static_cast<float>(time - last_seen);
+    m_rate[cell] += m_rate_filter * (rate - m_rate[cell]);
+  }
+  m_height[cell] = height;
+  m_last_seen[cell] = time;
+}
+
+// Marks a cell as a wall, either seen as one or found blocking a move.
+inline void LawnMap::SetWall(int32_t i, int32_t j)
+{
+  if (!IsInside(i, j)) {
+    return;
+  }
+  uint32_t const cell = GetCell(i, j);
+  if (!m_wall[cell]) {
+    m_wall[cell] = 1;
+    m_wall_count++;
+  }
+}
+
+// Works with both tme290::grass::Sensors and tme290::od4::SensorsView.
+template <typename T>
+inline void LawnMap::Update(T const &sensors)
+{
+  int32_t const i = static_cast<int32_t>(sensors.i());
+  int32_t const j = static_cast<int32_t>(sensors.j());
+  uint64_t const time = sensors.time();
+  if (time < m_time) {
+    Clear();
+  }
+  m_time = time;
+  Observe(i - 1, j - 1, sensors.grassTopLeft(), time);
+  Observe(i, j - 1, sensors.grassTopCentre(), time);
+  Observe(i + 1, j - 1, sensors.grassTopRight(), time);
+  Observe(i - 1, j, sensors.grassLeft(), time);
+  Observe(i, j, sensors.grassCentre(), time);
+  Observe(i + 1, j, sensors.grassRight(), time);
+  Observe(i - 1, j + 1, sensors.grassBottomLeft(), time);
+  Observe(i, j + 1, sensors.grassBottomCentre(), time);
+  Observe(i + 1, j + 1, sensors.grassBottomRight(), time);
+}
+
+}
+}
+
+#endif
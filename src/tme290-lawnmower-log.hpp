@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_LOG_HPP
+#define TME290_LAWNMOWER_LOG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tme290 {
+namespace lawnmower {
+
+// One controller tick, written as-is to the log file.
+struct TelemetryRecord {
+  uint64_t time;
+  int32_t i;
+  int32_t j;
+  int32_t lastcut_i;
+  int32_t lastcut_j;
+  float grass[9];
+  float rain;
+  float rainCloudDirX;
+  float rainCloudDirY;
+  float battery;
+  float batteryThreshold;
+  int8_t state;
+  int8_t command;
+  uint8_t padding[6];
+};
+
+char const LOG_MAGIC[8] = {'T', 'M', 'E', '2', '9', '0', 'L', 'G'};
+uint32_t const LOG_VERSION = 1;
+
+// Ring buffer sizes are powers of two so that indices can be masked.
+inline uint32_t roundUpToPowerOfTwo(uint32_t const value)
+{
+  uint32_t size{1};
+  while (size < value) {
+    size <<= 1;
+  }
+  return size;
+}
+
+// Single-producer, single-consumer logger. Log() copies the record into a
+// fixed ring buffer and returns; a background thread drains the buffer to
+// file. When the buffer is full the record is dropped and counted rather
+// than blocking the caller.
+class TelemetryLogger {
+  public:
+    TelemetryLogger(std::string const &, uint32_t const = 1 << 14);
+    virtual ~TelemetryLogger();
+    uint64_t GetDroppedCount() const;
+    bool IsOpen() const;
+    void Log(TelemetryRecord const &);
+
+  private:
+    TelemetryLogger(TelemetryLogger const &);
+    TelemetryLogger &operator=(TelemetryLogger const &);
+    uint32_t Drain();
+    void Run();
+
+    std::ofstream m_file;
+    std::vector<TelemetryRecord> m_buffer;
+    std::atomic<uint64_t> m_head;
+    std::atomic<uint64_t> m_tail;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<bool> m_running;
+    uint64_t const m_mask;
+    std::thread m_thread;
+};
+
+inline TelemetryLogger::TelemetryLogger(std::string const &filename,
+    uint32_t const capacity):
+  m_file(filename, std::ios::out | std::ios::binary | std::ios::trunc),
+  m_buffer(roundUpToPowerOfTwo(capacity)),
+  m_head(0),
+  m_tail(0),
+  m_dropped(0),
+  m_running(true),
+  m_mask(m_buffer.size() - 1),
+  m_thread()
+{
+  if (m_file.is_open()) {
+    uint32_t const recordSize = sizeof(TelemetryRecord);
+    m_file.write(LOG_MAGIC, sizeof(LOG_MAGIC));
+    m_file.write(reinterpret_cast<char const *>(&LOG_VERSION),
+        sizeof(LOG_VERSION));
+    m_file.write(reinterpret_cast<char const *>(&recordSize),
+        sizeof(recordSize));
+  }
+  m_thread = std::thread(&TelemetryLogger::Run, this);
+}
+
+inline TelemetryLogger::~TelemetryLogger()
+{
+  m_running.store(false, std::memory_order_release);
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  Drain();
+  m_file.flush();
+}
+
+inline uint32_t TelemetryLogger::Drain()
+{
+  uint64_t const head = m_head.load(std::memory_order_acquire);
+  uint64_t tail = m_tail.load(std::memory_order_relaxed);
+  uint32_t count{0};
+  while (tail != head) {
+    // Write the contiguous part of the ring in one go.
+    uint64_t const begin = tail & m_mask;
+    uint64_t const end = std::min<uint64_t>(begin + (head - tail),
+        m_buffer.size());
+    if (m_file.is_open()) {
+      m_file.write(reinterpret_cast<char const *>(&m_buffer[begin]),
+          (end - begin) * sizeof(TelemetryRecord));
+    }
+    tail += end - begin;
+    count += static_cast<uint32_t>(end - begin);
+    m_tail.store(tail, std::memory_order_release);
+  }
+  return count;
+}
+
+inline uint64_t TelemetryLogger::GetDroppedCount() const
+{
+  return m_dropped.load(std::memory_order_relaxed);
+}
+
+inline bool TelemetryLogger::IsOpen() const
+{
+  return m_file.is_open();
+}
+
+inline void TelemetryLogger::Log(TelemetryRecord const &record)
+{
+  uint64_t const head = m_head.load(std::memory_order_relaxed);
+  uint64_t const tail = m_tail.load(std::memory_order_acquire);
+  if (head - tail >= m_buffer.size()) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  m_buffer[head & m_mask] = record;
+  m_head.store(head + 1, std::memory_order_release);
+}
+
+inline void TelemetryLogger::Run()
+{
+  while (m_running.load(std::memory_order_acquire)) {
+    if (Drain() == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+// Reads a log written by TelemetryLogger. Returns false if the file cannot be
+// opened or was written with a different record layout.
+inline bool readTelemetryLog(std::string const &filename,
+    std::vector<TelemetryRecord> &records)
+{
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  char magic[sizeof(LOG_MAGIC)];
+  uint32_t version{0};
+  uint32_t recordSize{0};
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  file.read(reinterpret_cast<char *>(&recordSize), sizeof(recordSize));
+  if (!file || std::memcmp(magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0
+      || version != LOG_VERSION || recordSize != sizeof(TelemetryRecord)) {
+    return false;
+  }
+
+  TelemetryRecord record;
+  while (file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+    records.push_back(record);
+  }
+  return true;
+}
+
+}
+}
+
+#endif
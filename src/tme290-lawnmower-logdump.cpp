@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <vector>
+
+#include "tme290-lawnmower-log.hpp"
+
+int32_t main(int32_t argc, char **argv) {
+  int32_t retCode{0};
+  if (argc != 2) {
+    std::cerr << argv[0] 
+      << " prints a telemetry log written by tme290-lawnmower --log." 
+      << std::endl;
+    std::cerr << "Usage:   " << argv[0] << " <log file>" << std::endl;
+    std::cerr << "Example: " << argv[0] << " mower.log" << std::endl;
+    retCode = 1;
+  } else {
+    std::vector<tme290::lawnmower::TelemetryRecord> records;
+    if (!tme290::lawnmower::readTelemetryLog(argv[1], records)) {
+      std::cerr << "Could not read telemetry log '" << argv[1] << "'." 
+        << std::endl;
+      retCode = 1;
+    }
+
+    for (auto const &r : records) {
+      std::cout << "TIME: " << r.time << " STATE: " 
+        << static_cast<int32_t>(r.state) << " COMMAND: " 
+        << static_cast<int32_t>(r.command) << " POS: " << r.i << "," << r.j 
+        << " battery: " << r.battery << "\n";
+      std::cout << "rain: " << r.rain << " rainDirX: " << r.rainCloudDirX 
+        << " rainDirY: " << r.rainCloudDirY << "\n";
+      std::cout << "lastcut_i: " << r.lastcut_i << " lastcut_j: " 
+        << r.lastcut_j << " bt: " << r.batteryThreshold << "\n";
+      std::cout << r.grass[0] << " " << r.grass[1] << " " << r.grass[2] << "\n";
+      std::cout << r.grass[3] << " " << r.grass[4] << " " << r.grass[5] << "\n";
+      std::cout << r.grass[6] << " " << r.grass[7] << " " << r.grass[8] 
+        << "\n\n";
+    }
+  }
+  return retCode;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_NAVIGATION_HPP
+#define TME290_LAWNMOWER_NAVIGATION_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "tme290-lawnmower-lawnmap.hpp"
+
+namespace tme290 {
+namespace lawnmower {
+
+// Shortest 8-connected paths over the lawn, around the walls the lawn map has
+// observed so far; cells not yet seen are assumed to be free. A distance field
+// and a next-move table are computed by breadth-first search per target cell
+// the first time that target is asked for, after which every lookup is a
+// single table read. A field is computed again once the lawn map knows of
+// more walls than when it was built.
+class Navigation {
+  public:
+    static uint32_t const GRID_SIZE = LawnMap::GRID_SIZE;
+    static uint16_t const UNREACHABLE = 0xffff;
+
+    Navigation(LawnMap const &);
+    virtual ~Navigation();
+    uint16_t GetDistance(int32_t, int32_t, int32_t, int32_t);
+    uint16_t GetDistanceToCharge(int32_t, int32_t);
+    int32_t GetMove(int32_t, int32_t, int32_t, int32_t);
+    int32_t GetMoveToCharge(int32_t, int32_t);
+
+  private:
+    Navigation(Navigation const &);
+    Navigation &operator=(Navigation const &);
+
+    struct Field {
+      std::vector<uint16_t> distances{};
+      std::vector<uint8_t> moves{};
+      uint32_t walls{0};
+    };
+
+    static uint32_t GetCell(int32_t, int32_t);
+    static bool IsInside(int32_t, int32_t);
+    Field const &GetField(int32_t, int32_t);
+    void ComputeField(int32_t, int32_t, Field &) const;
+
+    LawnMap const &m_lawn_map;
+    std::vector<std::unique_ptr<Field>> m_fields;
+};
+
+// Command index to step, in the order of the controller's MOVE_* constants.
+namespace {
+int32_t const NAVIGATION_DI[9] = {0, -1, 0, 1, 1, 1, 0, -1, -1};
+int32_t const NAVIGATION_DJ[9] = {0, -1, -1, -1, 0, 1, 1, 1, 0};
+}
+
+inline Navigation::Navigation(LawnMap const &lawn_map):
+  m_lawn_map(lawn_map),
+  m_fields(GRID_SIZE * GRID_SIZE)
+{
+}
+
+inline Navigation::~Navigation()
+{
+}
+
+inline void Navigation::ComputeField(int32_t target_i, int32_t target_j,
+    Field &field) const
+{
+  field.distances.assign(GRID_SIZE * GRID_SIZE, UNREACHABLE);
+  field.moves.assign(GRID_SIZE * GRID_SIZE, 0);
+  field.walls = m_lawn_map.GetWallCount();
+  if (m_lawn_map.IsWall(target_i, target_j)) {
+    return;
+  }
+
+  // Searching outwards from the target, the move stored for a newly reached
+  // cell is the step back towards the cell it was reached from.
+  std::vector<uint32_t> queue;
+  queue.reserve(GRID_SIZE * GRID_SIZE);
+  uint32_t const target = GetCell(target_i, target_j);
+  field.distances[target] = 0;
+  queue.push_back(target);
+  for (uint32_t head{0}; head < queue.size(); head++) {
+    uint32_t const cell = queue[head];
+    int32_t const i = static_cast<int32_t>(cell % GRID_SIZE);
+    int32_t const j = static_cast<int32_t>(cell / GRID_SIZE);
+    for (uint8_t move{1}; move < 9; move++) {
+      int32_t const ni = i - NAVIGATION_DI[move];
+      int32_t const nj = j - NAVIGATION_DJ[move];
+      if (m_lawn_map.IsWall(ni, nj)) {
+        continue;
+      }
+      uint32_t const neighbour = GetCell(ni, nj);
+      if (field.distances[neighbour] != UNREACHABLE) {
+        continue;
+      }
+      field.distances[neighbour] =
+        static_cast<uint16_t>(field.distances[cell] + 1);
+      field.moves[neighbour] = move;
+      queue.push_back(neighbour);
+    }
+  }
+}
+
+inline uint32_t Navigation::GetCell(int32_t i, int32_t j)
+{
+  return static_cast<uint32_t>(j) * GRID_SIZE + static_cast<uint32_t>(i);
+}
+
+inline uint16_t Navigation::GetDistance(int32_t i, int32_t j,
+    int32_t target_i, int32_t target_j)
+{
+  if (!IsInside(i, j) || !IsInside(target_i, target_j)) {
+    return UNREACHABLE;
+  }
+  return GetField(target_i, target_j).distances[GetCell(i, j)];
+}
+
+inline uint16_t Navigation::GetDistanceToCharge(int32_t i, int32_t j)
+{
+  return GetDistance(i, j, 0, 0);
+}
+
+inline Navigation::Field const &Navigation::GetField(int32_t target_i,
+    int32_t target_j)
+{
+  std::unique_ptr<Field> &field = m_fields[GetCell(target_i, target_j)];
+  if (!field) {
+    field.reset(new Field());
+    ComputeField(target_i, target_j, *field);
+  } else if (field->walls != m_lawn_map.GetWallCount()) {
+    ComputeField(target_i, target_j, *field);
+  }
+  return *field;
+}
+
+// Returns the command (MOVE_*) that takes (i, j) one step closer to the
+// target, or 0 (stay) at the target or when it cannot be reached.
+inline int32_t Navigation::GetMove(int32_t i, int32_t j, int32_t target_i,
+    int32_t target_j)
+{
+  if (!IsInside(i, j) || !IsInside(target_i, target_j)) {
+    return 0;
+  }
+  return GetField(target_i, target_j).moves[GetCell(i, j)];
+}
+
+inline int32_t Navigation::GetMoveToCharge(int32_t i, int32_t j)
+{
+  return GetMove(i, j, 0, 0);
+}
+
+inline bool Navigation::IsInside(int32_t i, int32_t j)
+{
+  int32_t const size = static_cast<int32_t>(GRID_SIZE);
+  return i >= 0 && j >= 0 && i < size && j < size;
+}
+
+}
+}
+
+#endif
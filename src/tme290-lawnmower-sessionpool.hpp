@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_SESSIONPOOL_HPP
+#define TME290_LAWNMOWER_SESSIONPOOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "tme290-lawnmower-slotscheduler.hpp"
+#include "tme290-od4session.hpp"
+#include "tme290-sim-grass-msg.hpp"
+
+namespace tme290 {
+namespace lawnmower {
+
+// What SessionPool::RunEpisode saw of an episode besides its result: the
+// simulator slot it ran on, how long it waited for it and the simulated
+// ticks.
+struct EpisodeStatistics {
+  std::chrono::steady_clock::duration queueWait{};
+  uint64_t ticks{0};
+  int32_t slot{-1};
+};
+
+// One long-lived OD4 session per simulator CID, each owned by a worker thread
+// that runs episodes on it. The sockets, receiver threads and triggers are set
+// up once for the whole training instead of once per evaluation. Episodes go
+// to whichever session is free, see SlotScheduler.
+class SessionPool {
+  public:
+    typedef std::function<tme290::grass::Control(
+        tme290::grass::Sensors const &)> Policy;
+    typedef std::function<bool(tme290::grass::Status const &,
+        tme290::grass::Sensors const &)> StopCondition;
+
+    SessionPool(uint32_t const, uint32_t const, uint64_t const);
+    virtual ~SessionPool();
+    uint32_t GetSize() const;
+    bool IsRunning() const;
+    void PrintStatistics(std::ostream &) const;
+    double RunEpisode(Policy const &, uint64_t const,
+        StopCondition const & = StopCondition(),
+        EpisodeStatistics * = nullptr);
+
+  private:
+    SessionPool(SessionPool const &);
+    SessionPool &operator=(SessionPool const &);
+
+    struct Job {
+      Policy const *policy{nullptr};
+      StopCondition const *stopCondition{nullptr};
+      uint64_t seed{0};
+      uint64_t ticks{0};
+      std::promise<double> eta{};
+    };
+
+    struct Slot {
+      uint16_t cid{0};
+      std::mutex mutex{};
+      std::condition_variable jobAdded{};
+      Job *job{nullptr};
+      bool stop{false};
+      std::thread thread{};
+    };
+
+    void Run(Slot &);
+
+    std::vector<std::unique_ptr<Slot>> m_slots;
+    SlotScheduler m_scheduler;
+    std::atomic<bool> m_running;
+    uint64_t const m_max_time;
+};
+
+namespace {
+std::chrono::milliseconds const SESSION_CHECK_INTERVAL{100};
+std::chrono::milliseconds const STATUS_TIMEOUT{10};
+std::chrono::milliseconds const REPLY_TIMEOUT{100};
+}
+
+inline SessionPool::SessionPool(uint32_t const cid_start, uint32_t const size,
+    uint64_t const max_time):
+  m_slots(),
+  m_scheduler(size),
+  m_running(true),
+  m_max_time(max_time)
+{
+  for (uint32_t i{0}; i < size; i++) {
+    std::unique_ptr<Slot> slot(new Slot());
+    slot->cid = static_cast<uint16_t>(cid_start + i);
+    slot->thread = std::thread(&SessionPool::Run, this, std::ref(*slot));
+    m_slots.push_back(std::move(slot));
+  }
+}
+
+inline SessionPool::~SessionPool()
+{
+  for (auto &slot : m_slots) {
+    {
+      std::lock_guard<std::mutex> lock(slot->mutex);
+      slot->stop = true;
+    }
+    slot->jobAdded.notify_one();
+  }
+  for (auto &slot : m_slots) {
+    if (slot->thread.joinable()) {
+      slot->thread.join();
+    }
+  }
+}
+
+inline uint32_t SessionPool::GetSize() const
+{
+  return static_cast<uint32_t>(m_slots.size());
+}
+
+// False once any of the sessions has stopped, e.g. because the process is
+// being terminated.
+inline bool SessionPool::IsRunning() const
+{
+  return m_running.load();
+}
+
+inline void SessionPool::PrintStatistics(std::ostream &out) const
+{
+  m_scheduler.Print(out);
+}
+
+// Episode end, the final Status and the stop of the session are all waited
+// for on a condition variable that the receiver thread signals, so the next
+// episode can start as soon as the simulator has answered. The simulator does
+// not acknowledge Restart; it is sent on the same socket as the next episode's
+// first Control and is therefore handled before it. Every episode ends with a
+// restart on its own seed, so another one is only needed before an episode
+// on a different seed. An episode stopped on a Status still has a Control
+// in flight; the slot is only handed on once its Sensors reply has arrived,
+// or is taken as lost after REPLY_TIMEOUT, since the next episode would
+// otherwise answer it and run a second control chain on the simulator. The
+// policy belongs to the caller of RunEpisode and is called on the receiver
+// thread outside the lock, so the job is only finished once no call to it
+// is left running, however long that takes.
+inline void SessionPool::Run(Slot &slot)
+{
+  tme290::od4::Session od4(slot.cid);
+
+  std::mutex episodeMutex;
+  std::condition_variable episodeChanged;
+  Policy const *policy{nullptr};
+  StopCondition const *stopCondition{nullptr};
+  tme290::grass::Sensors lastSensors;
+  bool isRunning{false};
+  uint64_t endTime{0};
+  uint64_t statusTime{0};
+  bool hasStatus{false};
+  bool isRestarted{false};
+  uint64_t restartedSeed{0};
+  uint32_t unanswered{0};
+  uint32_t inPolicy{0};
+  double eta{1.0};
+
+  auto onSensors{[this, &od4, &episodeMutex, &episodeChanged, &policy,
+    &lastSensors, &isRunning, &endTime, &unanswered, &inPolicy](
+        cluon::data::Envelope &&envelope)
+    {
+      auto msg = cluon::extractMessage<tme290::grass::Sensors>(
+          std::move(envelope));
+      Policy const *currentPolicy{nullptr};
+      {
+        std::lock_guard<std::mutex> lock(episodeMutex);
+        if (unanswered > 0) {
+          unanswered--;
+        }
+        if (!isRunning) {
+          episodeChanged.notify_one();
+          return;
+        }
+        if ((msg.time() > m_max_time) || (msg.battery() <= 0.0)) {
+          isRunning = false;
+          endTime = msg.time();
+          episodeChanged.notify_one();
+          return;
+        }
+        lastSensors = msg;
+        unanswered++;
+        inPolicy++;
+        currentPolicy = policy;
+      }
+
+      auto control = (*currentPolicy)(msg);
+      od4.send(control);
+
+      std::lock_guard<std::mutex> lock(episodeMutex);
+      inPolicy--;
+      episodeChanged.notify_one();
+    }};
+
+  auto onStatus{[&episodeMutex, &episodeChanged, &stopCondition, &lastSensors,
+    &isRunning, &endTime, &statusTime, &hasStatus, &eta](
+        cluon::data::Envelope &&envelope)
+    {
+      auto msg = cluon::extractMessage<tme290::grass::Status>(
+          std::move(envelope));
+      std::lock_guard<std::mutex> lock(episodeMutex);
+      eta = msg.grassMax() * msg.grassMean();
+      statusTime = msg.time();
+      hasStatus = true;
+      if (isRunning && *stopCondition && (*stopCondition)(msg, lastSensors)) {
+        isRunning = false;
+        endTime = msg.time();
+      }
+      episodeChanged.notify_one();
+    }};
+
+  od4.dataTrigger(tme290::grass::Sensors::ID(),
+      std::function<void(cluon::data::Envelope &&)>(onSensors));
+  od4.dataTrigger(tme290::grass::Status::ID(),
+      std::function<void(cluon::data::Envelope &&)>(onStatus));
+
+  while (true) {
+    Job *job{nullptr};
+    {
+      std::unique_lock<std::mutex> lock(slot.mutex);
+      slot.jobAdded.wait(lock, [&slot]() {
+          return slot.stop || slot.job != nullptr;
+        });
+      if (slot.job == nullptr) {
+        break;
+      }
+      job = slot.job;
+      slot.job = nullptr;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(episodeMutex);
+      policy = job->policy;
+      stopCondition = job->stopCondition;
+      lastSensors = tme290::grass::Sensors();
+      eta = 1.0;
+      endTime = 0;
+      hasStatus = false;
+      isRunning = true;
+      unanswered = 1;
+    }
+
+    tme290::grass::Restart restart;
+    restart.seed(job->seed);
+    if (!isRestarted || restartedSeed != job->seed) {
+      od4.send(restart);
+    }
+
+    tme290::grass::Control control;
+    control.command(0);
+    od4.send(control);
+
+    // The session does not signal when it stops, so it is checked at an
+    // interval while waiting.
+    std::unique_lock<std::mutex> lock(episodeMutex);
+    while (isRunning && od4.isRunning()) {
+      episodeChanged.wait_for(lock, SESSION_CHECK_INTERVAL);
+    }
+    isRunning = false;
+    lock.unlock();
+
+    if (!od4.isRunning()) {
+      m_running.store(false);
+    }
+
+    od4.send(restart);
+    isRestarted = true;
+    restartedSeed = job->seed;
+
+    // Wait for the Status that covers the last tick, but no longer than the
+    // fixed pause that used to follow the restart.
+    lock.lock();
+    episodeChanged.wait_for(lock, STATUS_TIMEOUT, [&hasStatus, &statusTime,
+        &endTime]() {
+        return hasStatus && statusTime >= endTime;
+      });
+    episodeChanged.wait_for(lock, REPLY_TIMEOUT, [&unanswered]() {
+        return unanswered == 0;
+      });
+    episodeChanged.wait(lock, [&inPolicy]() {
+        return inPolicy == 0;
+      });
+    unanswered = 0;
+    policy = nullptr;
+    stopCondition = nullptr;
+    double const result = eta;
+    job->ticks = endTime;
+    lock.unlock();
+
+    job->eta.set_value(result);
+  }
+}
+
+// Runs one episode with the given seed on the first free simulator, waiting
+// for one if all are busy, and returns grassMax * grassMean of the last
+// Status seen. The episode also ends at the first Status for which the stop
+// condition, if given, returns true; it is passed the latest Sensors along
+// with it. The slot, queue wait and ticks are stored in statistics if given.
+inline double SessionPool::RunEpisode(Policy const &policy,
+    uint64_t const seed, StopCondition const &stop_condition,
+    EpisodeStatistics *statistics)
+{
+  auto const requested = std::chrono::steady_clock::now();
+  uint32_t const index = m_scheduler.Acquire();
+  auto const acquired = std::chrono::steady_clock::now();
+  Slot &slot = *m_slots[index];
+
+  Job job;
+  job.policy = &policy;
+  job.stopCondition = &stop_condition;
+  job.seed = seed;
+  std::future<double> eta = job.eta.get_future();
+  {
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    slot.job = &job;
+  }
+  slot.jobAdded.notify_one();
+  double const result = eta.get();
+  m_scheduler.Release(index);
+  if (statistics != nullptr) {
+    statistics->queueWait = acquired - requested;
+    statistics->ticks = job.ticks;
+    statistics->slot = static_cast<int32_t>(index);
+  }
+  return result;
+}
+
+}
+}
+
+#endif
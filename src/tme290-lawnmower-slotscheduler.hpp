@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_SLOTSCHEDULER_HPP
+#define TME290_LAWNMOWER_SLOTSCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace tme290 {
+namespace lawnmower {
+
+// Hands out a fixed set of slots (simulators) to callers. Free slots are kept
+// in a free-list; Acquire() blocks on a condition variable while the list is
+// empty and is woken by the Release() that frees a slot, so a slot never sits
+// idle while someone is waiting for it. Busy time and episode count are kept
+// per slot, together with how long callers had to wait.
+class SlotScheduler {
+  public:
+    SlotScheduler(uint32_t const);
+    virtual ~SlotScheduler();
+    uint32_t Acquire();
+    void Print(std::ostream &) const;
+    void Release(uint32_t const);
+
+  private:
+    SlotScheduler(SlotScheduler const &);
+    SlotScheduler &operator=(SlotScheduler const &);
+
+    struct SlotStatistics {
+      std::chrono::steady_clock::time_point acquired{};
+      std::chrono::steady_clock::duration busy{};
+      uint64_t episodes{0};
+    };
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_slot_released;
+    std::vector<uint32_t> m_free;
+    std::vector<SlotStatistics> m_statistics;
+    std::chrono::steady_clock::time_point const m_start;
+    std::chrono::steady_clock::duration m_wait_total;
+    std::chrono::steady_clock::duration m_wait_max;
+    uint64_t m_wait_count;
+};
+
+inline SlotScheduler::SlotScheduler(uint32_t const size):
+  m_mutex(),
+  m_slot_released(),
+  m_free(),
+  m_statistics(size),
+  m_start(std::chrono::steady_clock::now()),
+  m_wait_total(0),
+  m_wait_max(0),
+  m_wait_count(0)
+{
+  // Slot 0 is on top of the list and handed out first.
+  for (uint32_t i{size}; i > 0; i--) {
+    m_free.push_back(i - 1);
+  }
+}
+
+inline SlotScheduler::~SlotScheduler()
+{
+}
+
+inline uint32_t SlotScheduler::Acquire()
+{
+  auto const requested = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_slot_released.wait(lock, [this]() { return !m_free.empty(); });
+
+  uint32_t const slot = m_free.back();
+  m_free.pop_back();
+
+  auto const now = std::chrono::steady_clock::now();
+  auto const wait = now - requested;
+  m_wait_total += wait;
+  m_wait_max = std::max(m_wait_max, wait);
+  m_wait_count++;
+  m_statistics[slot].acquired = now;
+  return slot;
+}
+
+inline void SlotScheduler::Print(std::ostream &out) const
+{
+  auto seconds = [](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::duration<double>>(d)
+      .count();
+  };
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  double const elapsed = seconds(std::chrono::steady_clock::now() - m_start);
+  uint64_t episodes{0};
+  out << std::fixed << std::setprecision(3);
+  for (uint32_t i{0}; i < m_statistics.size(); i++) {
+    SlotStatistics const &statistics = m_statistics[i];
+    episodes += statistics.episodes;
+    out << "  slot " << i << ": " << statistics.episodes << " episodes, "
+      << std::setprecision(1)
+      << 100.0 * seconds(statistics.busy) / elapsed << "% busy"
+      << std::setprecision(3) << std::endl;
+  }
+  out << "  " << episodes << " episodes in " << elapsed << " s ("
+    << static_cast<double>(episodes) / elapsed << " episodes/s), "
+    << "queue wait mean "
+    << ((m_wait_count > 0)
+        ? 1000.0 * seconds(m_wait_total) / static_cast<double>(m_wait_count)
+        : 0.0)
+    << " ms, max " << 1000.0 * seconds(m_wait_max) << " ms" << std::endl;
+  out << std::defaultfloat;
+}
+
+inline void SlotScheduler::Release(uint32_t const slot)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    SlotStatistics &statistics = m_statistics[slot];
+    statistics.busy += std::chrono::steady_clock::now() - statistics.acquired;
+    statistics.episodes++;
+    m_free.push_back(slot);
+  }
+  m_slot_released.notify_one();
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "tme290-lawnmower-trainlog.hpp"
+
+// JSON has no NaN, so missing values are written as null.
+void printJsonNumber(double const value) {
+  if (std::isnan(value) || std::isinf(value)) {
+    std::cout << "null";
+  } else {
+    std::cout << value;
+  }
+}
+
+void printEvaluations(
+    std::vector<tme290::lawnmower::EvaluationRecord> const &evaluations,
+    std::vector<std::vector<double>> const &genomes, bool const json) {
+  if (json) {
+    std::cout << "[";
+  } else {
+    std::cout << "generation,start_ns,queue_wait_ns,duration_ns,slot,seed,"
+      << "ticks,fitness";
+    if (!genomes.empty()) {
+      for (uint32_t j{0}; j < genomes[0].size(); j++) {
+        std::cout << ",gene" << j;
+      }
+    }
+    std::cout << "\n";
+  }
+
+  for (uint32_t i{0}; i < evaluations.size(); i++) {
+    auto const &r = evaluations[i];
+    if (json) {
+      std::cout << ((i == 0) ? "\n" : ",\n") << "{\"generation\":"
+        << r.generation << ",\"start_ns\":" << r.start
+        << ",\"queue_wait_ns\":" << r.queueWait << ",\"duration_ns\":"
+        << r.duration << ",\"slot\":" << r.slot << ",\"seed\":"
+        << r.seed << ",\"ticks\":" << r.ticks << ",\"fitness\":";
+      printJsonNumber(r.fitness);
+      std::cout << ",\"genome\":[";
+      for (uint32_t j{0}; j < genomes[i].size(); j++) {
+        std::cout << ((j == 0) ? "" : ",");
+        printJsonNumber(genomes[i][j]);
+      }
+      std::cout << "]}";
+    } else {
+      std::cout << r.generation << "," << r.start << "," << r.queueWait << ","
+        << r.duration << "," << r.slot << "," << r.seed << "," << r.ticks
+        << "," << r.fitness;
+      for (double const gene : genomes[i]) {
+        std::cout << "," << gene;
+      }
+      std::cout << "\n";
+    }
+  }
+
+  if (json) {
+    std::cout << "\n]\n";
+  }
+}
+
+void printGenerations(
+    std::vector<tme290::lawnmower::GenerationRecord> const &generations,
+    bool const json) {
+  char const *names[5] = {"fitness_min", "fitness_q1", "fitness_median",
+    "fitness_q3", "fitness_max"};
+  if (json) {
+    std::cout << "[";
+  } else {
+    std::cout << "generation,start_ns,end_ns,evaluations,queue_wait_ns,"
+      << "duration_ns";
+    for (char const *name : names) {
+      std::cout << "," << name;
+    }
+    std::cout << ",fitness_mean,diversity\n";
+  }
+
+  for (uint32_t i{0}; i < generations.size(); i++) {
+    auto const &r = generations[i];
+    if (json) {
+      std::cout << ((i == 0) ? "\n" : ",\n") << "{\"generation\":"
+        << r.generation << ",\"start_ns\":" << r.start << ",\"end_ns\":"
+        << r.end << ",\"evaluations\":" << r.evaluations
+        << ",\"queue_wait_ns\":" << r.queueWait << ",\"duration_ns\":"
+        << r.duration;
+      for (uint32_t k{0}; k < 5; k++) {
+        std::cout << ",\"" << names[k] << "\":";
+        printJsonNumber(r.fitness[k]);
+      }
+      std::cout << ",\"fitness_mean\":";
+      printJsonNumber(r.fitnessMean);
+      std::cout << ",\"diversity\":";
+      printJsonNumber(r.diversity);
+      std::cout << "}";
+    } else {
+      std::cout << r.generation << "," << r.start << "," << r.end << ","
+        << r.evaluations << "," << r.queueWait << "," << r.duration;
+      for (double const fitness : r.fitness) {
+        std::cout << "," << fitness;
+      }
+      std::cout << "," << r.fitnessMean << "," << r.diversity << "\n";
+    }
+  }
+
+  if (json) {
+    std::cout << "\n]\n";
+  }
+}
+
+int32_t main(int32_t argc, char **argv) {
+  int32_t retCode{0};
+  std::string const table = (argc > 2) ? argv[2] : "evaluations";
+  std::string const format = (argc > 3) ? argv[3] : "csv";
+  if (argc < 2 || argc > 4
+      || (table != "evaluations" && table != "generations")
+      || (format != "csv" && format != "json")) {
+    std::cerr << argv[0]
+      << " exports a training log written by tme290-lawnmower-trainer --log."
+      << std::endl;
+    std::cerr << "Usage:   " << argv[0]
+      << " <log file> [evaluations|generations] [csv|json]" << std::endl;
+    std::cerr << "Example: " << argv[0] << " training.log generations json"
+      << std::endl;
+    retCode = 1;
+  } else {
+    std::vector<tme290::lawnmower::EvaluationRecord> evaluations;
+    std::vector<std::vector<double>> genomes;
+    std::vector<tme290::lawnmower::GenerationRecord> generations;
+    if (!tme290::lawnmower::readTrainingLog(argv[1], evaluations, genomes,
+          generations)) {
+      std::cerr << "Could not read training log '" << argv[1] << "'."
+        << std::endl;
+      retCode = 1;
+    } else {
+      std::cout << std::setprecision(
+          std::numeric_limits<double>::max_digits10);
+      if (table == "evaluations") {
+        printEvaluations(evaluations, genomes, format == "json");
+      } else {
+        printGenerations(generations, format == "json");
+      }
+    }
+  }
+  return retCode;
+}
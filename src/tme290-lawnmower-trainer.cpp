@@ -15,11 +15,24 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
 
 #include "cluon-complete.hpp"
 #include "tinyso.hpp"
+#include "tme290-lawnmower-islands.hpp"
+#include "tme290-lawnmower-sessionpool.hpp"
+#include "tme290-lawnmower-trainlog.hpp"
+#include "tme290-od4session.hpp"
 #include "tme290-sim-grass-msg.hpp"
+#include "tme290-sim-grass.hpp"
+#include "tme290-sim-grass-batch.hpp"
 
 tme290::grass::Control step(tme290::grass::Sensors sensors,
     tinyso::Individual const &ind) {
@@ -51,6 +64,98 @@ tme290::grass::Control step(tme290::grass::Sensors sensors,
   return control;
 }
 
+// The commands of every active episode in the batched simulator, taken from
+// step() so that there is only one policy.
+void stepBatch(tme290::grass::BatchSimulator const &sim,
+    tinyso::Population const &population, std::vector<uint8_t> &commands) {
+  for (uint32_t k{0}; k < sim.GetEpisodeCount(); k++) {
+    if (sim.IsActive(k)) {
+      commands[k] = static_cast<uint8_t>(
+          step(sim.GetSensors(k), population[k]).command());
+    }
+  }
+}
+
+// Racing: an episode is checked every RACE_CHECK_INTERVAL ticks and stopped
+// once it can no longer reach the threshold. Its fitness is then the best
+// case times RACE_PENALTY. The bounds below hold for the built-in simulator
+// only; against a CID simulator they are a heuristic, and an episode is
+// only stopped once its best case, raised by a slack (RACE_SLACK unless
+// given), still falls short.
+uint32_t const RACE_CHECK_INTERVAL = 100;
+double const RACE_PENALTY = 0.5;
+double const RACE_SLACK = 0.2;
+
+// The highest fitness an episode can still reach from the given Status with
+// the given number of ticks left. Each tick grows every cell by at least
+// GRASS_GROWTH (up to 1) and cuts at most GRASS_CUT from one cell, and
+// neither step can widen the difference between two lawns, so the final mean
+// is at least the grown mean minus all possible cuts. The final max is at
+// least the final mean, and at least the growth of a cell never cut.
+double bestCaseFitness(tme290::grass::Status const &status, 
+    uint64_t const remaining) {
+  static uint32_t const cellCount = []() {
+    uint32_t count{0};
+    int32_t const size = tme290::grass::Simulator::GRID_SIZE;
+    for (int32_t j{0}; j < size; j++) {
+      for (int32_t i{0}; i < size; i++) {
+        count += tme290::grass::isWall(i, j) ? 0 : 1;
+      }
+    }
+    return count;
+  }();
+
+  double const growth = static_cast<double>(tme290::grass::GRASS_GROWTH)
+    * remaining;
+  double const cuts = static_cast<double>(tme290::grass::GRASS_CUT) 
+    * remaining / cellCount;
+  double const grassMean = std::max(0.0, status.grassMean() 
+      + std::min(growth, 1.0 - status.grassMax()) - cuts);
+  double grassMax = grassMean;
+  if (remaining < cellCount) {
+    grassMax = std::max(grassMax, std::min(1.0, growth));
+  }
+  return 1.0 / (grassMax * grassMean);
+}
+
+// An upper bound on the ticks an episode has left. A mower that can no longer
+// reach the charger, even in a straight line ignoring the wall, only runs
+// until its battery is empty.
+uint64_t remainingTicks(tme290::grass::Sensors const &sensors,
+    uint64_t const maxTime) {
+  uint64_t const remaining = (sensors.time() < maxTime) 
+    ? maxTime - sensors.time() : 0;
+  double const distance = std::max(sensors.i(), sensors.j());
+  if (sensors.battery() + tme290::grass::BATTERY_CHARGE 
+      > distance * tme290::grass::BATTERY_DRAIN_MOVE) {
+    return remaining;
+  }
+  uint64_t const batteryTicks = static_cast<uint64_t>(
+      std::ceil(sensors.battery() / tme290::grass::BATTERY_DRAIN_STAY)) + 1;
+  return std::min(remaining, batteryTicks);
+}
+
+// Episode seeds are mixed from a seed drawn once per generation and the
+// individual's index, or its genes where the index is not known, so that they
+// do not depend on which thread starts its episode first (splitmix64).
+uint32_t episodeSeed(uint64_t const generationSeed, uint64_t const key) {
+  uint64_t z = generationSeed + 0x9e3779b97f4a7c15ull * (key + 1);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return static_cast<uint32_t>(z ^ (z >> 31));
+}
+
+// FNV-1a over the bytes of the genes.
+uint64_t genomeKey(tinyso::Individual const &ind) {
+  uint64_t hash{0xcbf29ce484222325ull};
+  unsigned char const *bytes = 
+    reinterpret_cast<unsigned char const *>(ind.data());
+  for (size_t k{0}; k < ind.size() * sizeof(double); k++) {
+    hash = (hash ^ bytes[k]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
 int32_t main(int32_t argc, char **argv) {
   int32_t retCode{0};
   auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
@@ -60,11 +165,49 @@ int32_t main(int32_t argc, char **argv) {
     std::cerr << "Usage:   " << argv[0] 
       << " --j=<Number of parallel threads (simulations)>" 
       << " [--cid-start=<CID interval start (end: cid-start+j). Default: 111>]" 
+      << " [--in-process (use the built-in simulator instead of CIDs)]"
+      << " [--batch (as --in-process, but each thread steps a whole chunk"
+      << " of the population at once)]"
+      << " [--seed=<Simulator seed for every episode. Default: random>]"
+      << " [--seeds=<Score every individual of a generation on the same"
+      << " number of random seeds (common random numbers)>]"
+      << " [--cache[=exact|freeze|average] (reuse fitness values of"
+      << " genomes already evaluated, default exact with --seed and freeze"
+      << " otherwise)]"
+      << " [--cache-samples=<Evaluations averaged before freezing. Default: 3>]"
+      << " [--checkpoint=<File to save the training state to>]"
+      << " [--checkpoint-interval=<Generations between checkpoints."
+      << " Default: 10>]"
+      << " [--resume (continue from the checkpoint file if it exists)]"
+      << " [--race[=<Quantile of the previous generation an episode must be"
+      << " able to reach to keep running. Default: 0.5>]"
+      << " [--race-slack=<Relative margin on the best case bound against"
+      << " CID simulators, where it is a heuristic. Default: 0.2>]"
+      << " [--surrogate[=<Candidates bred per offspring and ranked by a"
+      << " fitness model before simulation. Default: 4>]"
+      << " [--optimizer=<ga|cmaes|de|pso. Default: ga>]"
+      << " [--sigma=<Initial CMA-ES step size. Default: 0.3>]"
+      << " [--steady-state (breed a new individual as soon as an evaluation"
+      << " finishes instead of waiting for the whole generation)]"
+      << " [--islands=<Number of trainer processes exchanging migrants>"
+      << " --island=<Index of this process, 0 to islands-1>]"
+      << " [--topology=<ring|full|random. Default: ring>]"
+      << " [--migration-interval=<Generations between migrations."
+      << " Default: 10>]"
+      << " [--migrants=<Individuals sent per migration. Default: 2>]"
+      << " [--island-group=<Shared memory name prefix."
+      << " Default: tme290-lawnmower>]"
+      << " [--log=<File to record every episode and generation to>]"
       << " [--verbose]" << std::endl;
     std::cerr << "Example: " << argv[0] << " --j=2 --verbose" << std::endl;
     retCode = 1;
   } else {
     bool const verbose = (commandlineArguments.count("verbose") != 0);
+    // Cleared by options that cannot be run as given; nothing is trained then.
+    bool isValid{true};
+    bool const batch = (commandlineArguments.count("batch") != 0);
+    bool const inProcess = batch 
+      || (commandlineArguments.count("in-process") != 0);
     uint16_t const jobs = std::stoi(commandlineArguments["j"]);
     uint32_t const cidStart = (commandlineArguments.count("cid-start") != 0) 
       ? std::stoi(commandlineArguments["cid-start"]) : 111;
@@ -80,124 +223,532 @@ int32_t main(int32_t argc, char **argv) {
     float probSelectTournament = 0.8f;
     
     uint32_t simMaxTime = 4000;
-    bool randomSeed = true;
+    bool randomSeed = (commandlineArguments.count("seed") == 0);
+    uint32_t const fixedSeed = randomSeed 
+      ? 1234 : std::stoul(commandlineArguments["seed"]);
 
     std::random_device rd;
     std::mt19937 rg(rd());
+    std::mutex rgMutex;
+    // Drawn from rg before every generation in the generational mode. The
+    // steady-state mode has no such point and draws every seed from rg.
+    bool seedsPerGeneration{false};
+    uint32_t generationSeed{0};
 
     bool terminate{false};
 
-    std::map<uint32_t, std::mutex> cidLocks;
-    for (uint32_t i{0}; i < jobs; i++) {
-      uint32_t cid = cidStart + i;
-      cidLocks.emplace(std::piecewise_construct, std::make_tuple(cid),
-          std::make_tuple());
+    std::unique_ptr<tme290::lawnmower::TrainingLog> trainingLog;
+    if (commandlineArguments.count("log") != 0) {
+      std::string const log = commandlineArguments["log"];
+      trainingLog.reset(new tme290::lawnmower::TrainingLog(log, 
+            individualLength));
+      if (!trainingLog->IsOpen()) {
+        std::cerr << "Could not open training log '" << log << "'." 
+          << std::endl;
+      }
     }
 
-    auto evaluate{[&cidStart, &jobs, &cidLocks, &simMaxTime, &rg, &randomSeed, &terminate](
-        tinyso::Individual const &ind, uint32_t const) -> double
+    std::atomic<uint64_t> racedEpisodes{0};
+    std::atomic<uint64_t> ticksSaved{0};
+
+    auto evaluateInProcess{[&simMaxTime, &racedEpisodes, &ticksSaved](
+        tinyso::Individual const &ind, uint64_t const seed,
+        tinyso::Fitnesses const &thresholds, 
+        tme290::lawnmower::EpisodeStatistics &episode) -> double
       {
-        uint32_t cid = cidStart;
-        while (!cidLocks[cid].try_lock()) {
-          std::this_thread::sleep_for(std::chrono::milliseconds(10));
-          cid++;
-          if (cid > cidStart + jobs) {
-            cid = cidStart;
+        tme290::grass::Simulator sim(static_cast<uint32_t>(seed));
+
+        tme290::grass::Control control;
+        control.command(0);
+        while (true) {
+          auto sensors = sim.Step(control);
+          episode.ticks = sensors.time();
+          if ((sensors.time() > simMaxTime) || (sensors.battery() <= 0.0)) {
+            break;
+          }
+          if (!thresholds.empty() && sensors.time() % RACE_CHECK_INTERVAL == 0) {
+            uint64_t const remaining = remainingTicks(sensors, simMaxTime);
+            double const bestCase = bestCaseFitness(sim.GetStatus(), remaining);
+            if (bestCase < thresholds[0]) {
+              racedEpisodes++;
+              ticksSaved += remaining;
+              return RACE_PENALTY * bestCase;
+            }
           }
+          control = step(sensors, ind);
         }
 
-        double eta{1.0};
-        {
-          cluon::OD4Session od4(cid);
-          bool isRunning{true};
-
-          auto onSensors{[&od4, &ind, &isRunning, &simMaxTime](
-              cluon::data::Envelope &&envelope)
-            {
-              auto msg = cluon::extractMessage<tme290::grass::Sensors>(
-                  std::move(envelope));
+        auto status = sim.GetStatus();
+        double const eta = status.grassMax() * status.grassMean();
+        return 1.0 / eta;
+      }};
 
-              if ((msg.time() > simMaxTime) || (msg.battery() <= 0.0)) {
-                isRunning = false;
-                return;
-              }
+    // A chunk does not know where in the population it starts, so its seeds
+    // are keyed on the genes; equal genomes then share a lawn.
+    auto evaluateBatch{[&simMaxTime, &randomSeed, &fixedSeed, &generationSeed,
+      &trainingLog](tinyso::Population const &population) -> tinyso::Fitnesses
+      {
+        auto const start = std::chrono::steady_clock::now();
+        uint32_t const episodeCount = population.size();
+        std::vector<uint32_t> seeds(episodeCount, fixedSeed);
+        if (randomSeed) {
+          for (uint32_t k{0}; k < episodeCount; k++) {
+            seeds[k] = episodeSeed(generationSeed, genomeKey(population[k]));
+          }
+        }
 
-              auto control = step(msg, ind);
-              od4.send(control);
-            }};
+        tme290::grass::BatchSimulator sim(seeds);
+        tinyso::Fitnesses fitnesses(episodeCount, 0.0);
+        std::vector<uint64_t> ticks(episodeCount, 0);
+        std::vector<uint8_t> commands(episodeCount, 0);
 
-          auto onStatus{[&eta](
-              cluon::data::Envelope &&envelope)
-            {
-              auto msg = cluon::extractMessage<tme290::grass::Status>(
-                  std::move(envelope));
-              eta = msg.grassMax() * msg.grassMean();
-            }};
+        while (sim.GetActiveCount() > 0) {
+          sim.Step(commands);
 
-          od4.dataTrigger(tme290::grass::Sensors::ID(), onSensors);
-          od4.dataTrigger(tme290::grass::Status::ID(), onStatus);
+          std::vector<uint64_t> const &time = sim.GetTime();
+          std::vector<float> const &battery = sim.GetBattery();
+          for (uint32_t k{0}; k < episodeCount; k++) {
+            if (sim.IsActive(k) 
+                && ((time[k] > simMaxTime) || (battery[k] <= 0.0))) {
+              auto status = sim.GetStatus(k);
+              fitnesses[k] = 1.0 / (status.grassMax() * status.grassMean());
+              ticks[k] = time[k];
+              sim.SetActive(k, false);
+            }
+          }
 
-          tme290::grass::Control control;
-          control.command(0);
-          od4.send(control);
+          stepBatch(sim, population, commands);
+        }
 
-          while (isRunning && od4.isRunning()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        // The episodes of a chunk all run for as long as the chunk.
+        if (trainingLog) {
+          auto const duration = std::chrono::steady_clock::now() - start;
+          for (uint32_t k{0}; k < episodeCount; k++) {
+            trainingLog->LogEvaluation(population[k], seeds[k], fitnesses[k],
+                start, std::chrono::steady_clock::duration(0), duration, 
+                ticks[k], -1);
           }
+        }
+        return fitnesses;
+      }};
 
-          if (!od4.isRunning()) {
-            terminate = true;
-          }
+    double const raceSlack = (commandlineArguments.count("race-slack") != 0) 
+      ? std::stod(commandlineArguments["race-slack"]) : RACE_SLACK;
 
-          tme290::grass::Restart restart;
-          if (!randomSeed) {
-            restart.seed(1234);
-          } else {
-            std::uniform_int_distribution<unsigned long long> dist;
-            restart.seed(dist(rg));
-          }
-          od4.send(restart);
+    std::unique_ptr<tme290::lawnmower::SessionPool> pool;
+    if (!inProcess) {
+      pool.reset(new tme290::lawnmower::SessionPool(cidStart, jobs,
+            simMaxTime));
+    }
 
-          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto evaluate{[&pool, &simMaxTime, &raceSlack, &terminate, &racedEpisodes, 
+      &ticksSaved](tinyso::Individual const &ind, uint64_t const seed,
+          tinyso::Fitnesses const &thresholds, 
+          tme290::lawnmower::EpisodeStatistics &episode) -> double
+      {
+        tme290::lawnmower::SessionPool::Policy const policy{
+          [&ind](tme290::grass::Sensors const &sensors)
+          {
+            return step(sensors, ind);
+          }};
 
-          cidLocks[cid].unlock();
+        // Races on the Status messages the simulator sends during the episode.
+        // The bound assumes the growth, cutting and battery constants of the
+        // built-in simulator, hence the slack.
+        bool raced{false};
+        double bestCase{0.0};
+        uint64_t remaining{0};
+        tme290::lawnmower::SessionPool::StopCondition stopCondition;
+        if (!thresholds.empty()) {
+          stopCondition = [&simMaxTime, &raceSlack, &thresholds, &raced, 
+            &bestCase, &remaining](tme290::grass::Status const &status,
+              tme290::grass::Sensors const &sensors)
+            {
+              uint64_t const left = remainingTicks(sensors, simMaxTime);
+              double const fitness = bestCaseFitness(status, left);
+              if (fitness * (1.0 + raceSlack) < thresholds[0]) {
+                raced = true;
+                bestCase = fitness;
+                remaining = left;
+              }
+              return raced;
+            };
+        }
+
+        double const eta = pool->RunEpisode(policy, seed, stopCondition, 
+            &episode);
+        if (!pool->IsRunning()) {
+          terminate = true;
+        }
+        if (raced) {
+          racedEpisodes++;
+          ticksSaved += remaining;
+          return RACE_PENALTY * bestCase;
         }
         return 1.0 / eta;
       }};
 
 
     if (verbose) {
-      std::cout << "Starting the training using " << jobs << " threads." 
-        << std::endl;
+      std::cout << "Starting the training using " << jobs << " threads" 
+        << (batch ? " (batched in-process simulator)." 
+            : (inProcess ? " (in-process simulator)." : ".")) << std::endl;
     }
 
-    tinyso::GeneticAlgorithm ga(evaluate, crossoverMethod, individualLength, 
+    // One episode on the given seed, raced against the given thresholds, and
+    // logged if asked for.
+    std::function<double(tinyso::Individual const &, uint64_t const,
+        tinyso::Fitnesses const &)> runEpisode = [&evaluate, 
+      &evaluateInProcess, &inProcess, &trainingLog](
+          tinyso::Individual const &ind, uint64_t const seed,
+          tinyso::Fitnesses const &thresholds) {
+        tme290::lawnmower::EpisodeStatistics episode;
+        auto const start = std::chrono::steady_clock::now();
+        double const fitness = inProcess 
+          ? evaluateInProcess(ind, seed, thresholds, episode) 
+          : evaluate(ind, seed, thresholds, episode);
+        if (trainingLog) {
+          trainingLog->LogEvaluation(ind, seed, fitness, start, 
+              episode.queueWait, std::chrono::steady_clock::now() - start 
+              - episode.queueWait, episode.ticks, episode.slot);
+        }
+        return fitness;
+      };
+    std::function<double(tinyso::Individual const &, uint32_t const,
+        tinyso::Fitnesses const &)> evaluateRacing = [&runEpisode, &rg,
+      &rgMutex, &randomSeed, &fixedSeed, &seedsPerGeneration, 
+      &generationSeed](tinyso::Individual const &ind, uint32_t const index,
+          tinyso::Fitnesses const &thresholds) {
+        uint32_t seed{fixedSeed};
+        if (randomSeed && seedsPerGeneration) {
+          seed = episodeSeed(generationSeed, index);
+        } else if (randomSeed) {
+          std::lock_guard<std::mutex> lock(rgMutex);
+          std::uniform_int_distribution<uint32_t> dist;
+          seed = dist(rg);
+        }
+        return runEpisode(ind, seed, thresholds);
+      };
+    tinyso::Fitnesses const noThresholds;
+    std::function<double(tinyso::Individual const &, uint32_t const)> 
+      evaluateIndividual = [&evaluateRacing, &noThresholds](
+          tinyso::Individual const &ind, uint32_t const index) {
+        return evaluateRacing(ind, index, noThresholds);
+      };
+
+    tinyso::GeneticAlgorithm ga(evaluateIndividual, crossoverMethod, individualLength, 
         eliteSize, populationSize, tournamentSize, probCrossover, probMutation, 
         probSelectTournament);
+    if (batch) {
+      ga.SetEvaluatePopulation(evaluateBatch);
+    }
+    if (commandlineArguments.count("race") != 0) {
+      std::string const race = commandlineArguments["race"];
+      // A bare --race is reported as "1".
+      double const raceQuantile = (race == "1") ? 0.5 : std::stod(race);
+      // A stopped episode's penalised fitness would be cached and fitted to
+      // as if it had been measured.
+      if (batch) {
+        std::cerr << "Racing is not available with --batch." << std::endl;
+      } else if (commandlineArguments.count("cache") != 0 
+          || commandlineArguments.count("surrogate") != 0) {
+        std::cerr << "Racing is not available with --cache or --surrogate." 
+          << std::endl;
+      } else {
+        ga.SetRacing({raceQuantile}, evaluateRacing);
+      }
+    }
+    // A cached fitness would be reused on other generations' seeds.
+    if (commandlineArguments.count("cache") != 0 
+        && commandlineArguments.count("seeds") == 0) {
+      std::string const cache = commandlineArguments["cache"];
+      uint32_t const cacheSamples = 
+        (commandlineArguments.count("cache-samples") != 0) 
+        ? std::stoi(commandlineArguments["cache-samples"]) : 3;
+      tinyso::CachePolicy cachePolicy = randomSeed 
+        ? tinyso::CachePolicy::Freeze : tinyso::CachePolicy::Exact;
+      if (cache == "exact") {
+        cachePolicy = tinyso::CachePolicy::Exact;
+      } else if (cache == "freeze") {
+        cachePolicy = tinyso::CachePolicy::Freeze;
+      } else if (cache == "average") {
+        cachePolicy = tinyso::CachePolicy::Average;
+      }
+      // An exact cache would keep the first noisy sample of every genome
+      // when the lawns are random.
+      if (cachePolicy == tinyso::CachePolicy::Exact && randomSeed) {
+        std::cerr << "--cache=exact needs --seed, using freeze." << std::endl;
+        cachePolicy = tinyso::CachePolicy::Freeze;
+      }
+      ga.SetEvaluationCache(cachePolicy, cacheSamples);
+      if (!randomSeed) {
+        ga.SetEvaluationSeed(fixedSeed);
+      }
+    }
+    if (commandlineArguments.count("surrogate") != 0) {
+      std::string const surrogate = commandlineArguments["surrogate"];
+      // A bare --surrogate is reported as "1".
+      uint32_t const surrogatePool = (surrogate == "1") 
+        ? 4 : std::stoi(surrogate);
+      ga.SetSurrogate(surrogatePool);
+      if (verbose) {
+        std::cout << "Pre-screening " << surrogatePool 
+          << " candidates per offspring with a surrogate model." << std::endl;
+      }
+    }
+    std::unique_ptr<tme290::lawnmower::IslandExchange> islands;
+    if (commandlineArguments.count("islands") != 0) {
+      uint32_t const islandCount = std::stoi(commandlineArguments["islands"]);
+      uint32_t const island = (commandlineArguments.count("island") != 0) 
+        ? std::stoi(commandlineArguments["island"]) : 0;
+      uint32_t const migrationInterval = 
+        (commandlineArguments.count("migration-interval") != 0) 
+        ? std::stoi(commandlineArguments["migration-interval"]) : 10;
+      uint32_t const migrants = (commandlineArguments.count("migrants") != 0) 
+        ? std::stoi(commandlineArguments["migrants"]) : 2;
+      std::string const islandGroup = 
+        (commandlineArguments.count("island-group") != 0) 
+        ? commandlineArguments["island-group"] : "tme290-lawnmower";
+      std::string const topologyName = 
+        (commandlineArguments.count("topology") != 0) 
+        ? commandlineArguments["topology"] : "ring";
+      tme290::lawnmower::Topology topology = tme290::lawnmower::RING;
+      if (topologyName == "full") {
+        topology = tme290::lawnmower::FULL;
+      } else if (topologyName == "random") {
+        topology = tme290::lawnmower::RANDOM;
+      } else if (topologyName != "ring") {
+        std::cerr << "Unknown topology '" << topologyName << "'." << std::endl;
+        isValid = false;
+      }
+
+      islands.reset(new tme290::lawnmower::IslandExchange(islandGroup, island,
+            islandCount, topology, migrants, individualLength));
+      ga.SetRandomSeed(rd());
+      ga.SetMigration(migrationInterval, migrants, 
+          [&islands](tinyso::Population const &emigrants, 
+            tinyso::Fitnesses const &fitnesses) {
+            return islands->Migrate(emigrants, fitnesses);
+          });
+      if (verbose) {
+        std::cout << "Island " << island << " of " << islandCount << ", "
+          << topologyName << " topology, " << migrants << " migrants every "
+          << migrationInterval << " generations." << std::endl;
+      }
+    }
+    // The other optimizers replace the genetic algorithm, whose options then
+    // do not apply. They use the same population size, except CMA-ES.
+    std::string const optimizerName = 
+      (commandlineArguments.count("optimizer") != 0) 
+      ? commandlineArguments["optimizer"] : "ga";
+    std::unique_ptr<tinyso::Optimizer> alternative;
+    if (optimizerName == "cmaes") {
+      double const sigma = (commandlineArguments.count("sigma") != 0) 
+        ? std::stod(commandlineArguments["sigma"]) : 0.3;
+      alternative.reset(new tinyso::CmaEs(evaluateIndividual, 
+            individualLength, 0, sigma));
+    } else if (optimizerName == "de") {
+      alternative.reset(new tinyso::DifferentialEvolution(evaluateIndividual,
+            individualLength, populationSize));
+    } else if (optimizerName == "pso") {
+      alternative.reset(new tinyso::ParticleSwarm(evaluateIndividual,
+            individualLength, populationSize));
+    } else if (optimizerName != "ga") {
+      std::cerr << "Unknown optimizer '" << optimizerName 
+        << "', using ga." << std::endl;
+    }
+    if (alternative) {
+      for (std::string const option : {"batch", "cache", "islands", "race",
+          "seeds", "steady-state", "surrogate"}) {
+        if (commandlineArguments.count(option) != 0) {
+          std::cerr << "--" << option << " is not available with"
+            << " --optimizer=" << optimizerName << "." << std::endl;
+        }
+      }
+      if (verbose) {
+        std::cout << "Using " << optimizerName << " with " 
+          << alternative->GetPopulationSize() 
+          << " candidates per generation." << std::endl;
+      }
+    }
+    tinyso::Optimizer &optimizer = alternative ? *alternative : ga;
 
-    for (uint32_t i{0}; i < generationCount && !terminate; i++) {
-      ga.NextGeneration(jobs);
+    // Common random numbers: every individual of a generation is evaluated on
+    // the same seeds, drawn by the optimizer, so that their fitnesses differ
+    // by the controller rather than by the lawn. Only the GA scores its whole
+    // population again on every generation's seeds.
+    uint32_t const seedCount = (!alternative 
+        && commandlineArguments.count("seeds") != 0) 
+      ? std::stoi(commandlineArguments["seeds"]) : 0;
+    if (seedCount > 0) {
+      ga.SetSeededEvaluation(seedCount, [&runEpisode, &noThresholds](
+            tinyso::Individual const &ind, uint32_t const, 
+            uint64_t const seed) {
+            return runEpisode(ind, seed, noThresholds);
+          });
+      for (std::string const option : {"batch", "cache", "race", "seed", 
+          "steady-state"}) {
+        if (commandlineArguments.count(option) != 0) {
+          std::cerr << "--" << option << " is not used with --seeds." 
+            << std::endl;
+        }
+      }
+      if (verbose) {
+        std::cout << "Evaluating every individual on the same " << seedCount
+          << " seeds per generation." << std::endl;
+      }
+    }
 
+    if (commandlineArguments.count("checkpoint") != 0) {
+      std::string const checkpoint = commandlineArguments["checkpoint"];
+      uint32_t const checkpointInterval = 
+        (commandlineArguments.count("checkpoint-interval") != 0) 
+        ? std::stoi(commandlineArguments["checkpoint-interval"]) : 10;
+
+      // The trainer's own generator, which picks the simulator seeds, is
+      // stored with the checkpoint.
+      if (commandlineArguments.count("resume") != 0) {
+        std::string generatorState;
+        if (optimizer.LoadCheckpoint(checkpoint, generatorState)) {
+          std::istringstream sstr(generatorState);
+          sstr >> rg;
+          if (verbose) {
+            std::cout << "Resuming from '" << checkpoint << "' at generation "
+              << optimizer.GetGenerationIndex() << "." << std::endl;
+          }
+        } else if (verbose) {
+          std::cout << "No usable checkpoint in '" << checkpoint 
+            << "', starting over." << std::endl;
+        }
+      }
+      optimizer.SetCheckpoint(checkpoint, checkpointInterval, 
+          [&rg, &rgMutex]() {
+            std::lock_guard<std::mutex> lock(rgMutex);
+            std::ostringstream sstr;
+            sstr << rg;
+            return sstr.str();
+          });
+    }
+    if (trainingLog) {
+      trainingLog->SetGeneration(optimizer.GetGenerationIndex());
       if (verbose) {
-        auto bestInd = ga.GetBestIndividual();
+        std::cout << "Logging every episode and generation to '" 
+          << commandlineArguments["log"] << "'." << std::endl;
+      }
+    }
+
+    auto printGeneration{[&individualLength](uint32_t const i, 
+        double const bestFitness, tinyso::Individual const &bestInd) {
         std::cout << " .. generation " << i << ", best fitness " 
-          << ga.GetBestFitness() << " (" << bestInd[0];
+          << bestFitness << " (" << bestInd[0];
         for (uint32_t j{1}; j < individualLength; j++) {
           std::cout << ", " << bestInd[j];
         }
         std::cout << ")" << std::endl;
+      }};
+
+    // The spread over the seeds of the generation's best individual, and the
+    // mean spread over the population.
+    auto printSeedStatistics{[&optimizer, &seedCount]() {
+        tinyso::Fitnesses const fitnesses = optimizer.GetFitnesses();
+        tinyso::Fitnesses const variances = optimizer.GetFitnessVariances();
+        int32_t best{-1};
+        double sdSum{0.0};
+        uint32_t sdCount{0};
+        for (uint32_t i{0}; i < variances.size() && i < fitnesses.size(); 
+            i++) {
+          if (std::isnan(variances[i]) || std::isnan(fitnesses[i])) {
+            continue;
+          }
+          if (best < 0 || fitnesses[i] > fitnesses[best]) {
+            best = i;
+          }
+          sdSum += std::sqrt(variances[i]);
+          sdCount++;
+        }
+        if (best >= 0) {
+          std::cout << "    over " << seedCount << " seeds: generation best " 
+            << fitnesses[best] << " (sd " << std::sqrt(variances[best]) 
+            << "), mean sd " << sdSum / sdCount << std::endl;
+        }
+      }};
+
+    bool const steadyState = !alternative && seedCount == 0
+      && (commandlineArguments.count("steady-state") != 0);
+    if (steadyState && batch) {
+      std::cerr << "The steady-state mode is not available with --batch." 
+        << std::endl;
+      isValid = false;
+    }
+    if (isValid) {
+      if (steadyState) {
+        uint32_t const start = ga.GetGenerationIndex();
+        ga.RunSteadyState(jobs, 
+            (start < generationCount) ? generationCount - start : 0,
+            [&verbose, &terminate, &printGeneration, &trainingLog](
+              tinyso::SteadyStateGeneration const &generation) {
+              if (trainingLog) {
+                trainingLog->LogGeneration(generation.generation_index - 1, 
+                    generation.fitnesses, generation.population);
+              }
+              if (verbose) {
+                printGeneration(generation.generation_index - 1, 
+                    generation.best_fitness, generation.best_individual);
+              }
+              return !terminate;
+            });
+      } else {
+        seedsPerGeneration = true;
+        for (uint32_t i = optimizer.GetGenerationIndex(); 
+            i < generationCount && !terminate; i++) {
+          {
+            std::lock_guard<std::mutex> lock(rgMutex);
+            std::uniform_int_distribution<uint32_t> dist;
+            generationSeed = dist(rg);
+          }
+          optimizer.NextGeneration(jobs);
+          if (trainingLog) {
+            trainingLog->LogGeneration(i, optimizer.GetFitnesses(), 
+                optimizer.GetPopulation());
+          }
+          if (verbose) {
+            printGeneration(i, optimizer.GetBestFitness(), 
+                optimizer.GetBestIndividual());
+            if (seedCount > 0) {
+              printSeedStatistics();
+            }
+          }
+        }
       }
     }
       
-    if (verbose) {
-      auto bestInd = ga.GetBestIndividual();
+    if (isValid && verbose) {
+      auto const &bestInd = optimizer.GetBestIndividual();
       std::cout << "Training done, best fitness " 
-        << ga.GetBestFitness() << std::endl;
+        << optimizer.GetBestFitness() << std::endl;
       for (uint32_t i{0}; i < individualLength; i++) {
         std::cout << "  param " << i << ": " << bestInd[i] << std::endl;
       }
+      if (ga.GetCacheLookupCount() > 0) {
+        std::cout << "Fitness cache: " << ga.GetCacheHitCount() << " hits in "
+          << ga.GetCacheLookupCount() << " lookups (" 
+          << 100.0 * ga.GetCacheHitCount() / ga.GetCacheLookupCount() 
+          << "%)" << std::endl;
+      }
+      if (islands) {
+        std::cout << "Took in " << islands->GetImmigrantCount() 
+          << " migrants." << std::endl;
+      }
+      if (racedEpisodes > 0) {
+        std::cout << "Racing stopped " << racedEpisodes << " episodes early,"
+          << " saving " << ticksSaved << " simulator ticks." << std::endl;
+      }
+      if (pool) {
+        std::cout << "Simulator usage:" << std::endl;
+        pool->PrintStatistics(std::cout);
+      }
     }
-    retCode = 0;
+    retCode = isValid ? 0 : 1;
   }
   return retCode;
 }
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_LAWNMOWER_TRAINLOG_HPP
+#define TME290_LAWNMOWER_TRAINLOG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tme290 {
+namespace lawnmower {
+
+// Kinds of records in a training log.
+enum TrainingRecordKind : uint32_t { EVALUATION = 1, GENERATION = 2 };
+
+// One simulated episode, followed in the file by the genome that was
+// evaluated. All times are in nanoseconds, start relative to the opening of
+// the log. An in-process episode has no simulator slot (-1) and no queue
+// wait.
+struct EvaluationRecord {
+  uint32_t kind;
+  uint32_t generation;
+  uint64_t seed;
+  double fitness;
+  uint64_t start;
+  uint64_t queueWait;
+  uint64_t duration;
+  uint64_t ticks;
+  int32_t slot;
+  uint32_t padding;
+};
+
+// One generation: its span, the episodes logged during it, the minimum,
+// quartiles and maximum of its fitness, and the diversity of the candidates
+// the optimizer holds after it, as the mean standard deviation per gene.
+struct GenerationRecord {
+  uint32_t kind;
+  uint32_t generation;
+  uint64_t start;
+  uint64_t end;
+  uint64_t evaluations;
+  uint64_t queueWait;
+  uint64_t duration;
+  double fitness[5];
+  double fitnessMean;
+  double diversity;
+};
+
+char const TRAINLOG_MAGIC[8] = {'T', 'M', 'E', '2', '9', '0', 'T', 'R'};
+uint32_t const TRAINLOG_VERSION = 1;
+
+// Writes evaluation and generation records of a training run. Episodes end
+// on many threads but at most a few thousand times per second, so records
+// are written directly under a mutex instead of through a ring buffer as in
+// TelemetryLogger. The file is flushed at every generation.
+class TrainingLog {
+  public:
+    TrainingLog(std::string const &, uint32_t const);
+    virtual ~TrainingLog();
+    bool IsOpen() const;
+    void LogEvaluation(std::vector<double> const &, uint64_t const,
+        double const, std::chrono::steady_clock::time_point const &,
+        std::chrono::steady_clock::duration const &,
+        std::chrono::steady_clock::duration const &, uint64_t const,
+        int32_t const);
+    void LogGeneration(uint32_t const, std::vector<double> const &,
+        std::vector<std::vector<double>> const &);
+    void SetGeneration(uint32_t const);
+
+  private:
+    TrainingLog(TrainingLog const &);
+    TrainingLog &operator=(TrainingLog const &);
+    uint64_t GetNanoseconds(std::chrono::steady_clock::duration const &)
+      const;
+
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    std::chrono::steady_clock::time_point const m_start;
+    std::chrono::steady_clock::time_point m_generation_start;
+    std::atomic<uint32_t> m_generation;
+    uint64_t m_evaluations;
+    uint64_t m_queue_wait;
+    uint64_t m_duration;
+    uint32_t const m_length;
+};
+
+inline TrainingLog::TrainingLog(std::string const &filename,
+    uint32_t const length):
+  m_mutex(),
+  m_file(filename, std::ios::out | std::ios::binary | std::ios::trunc),
+  m_start(std::chrono::steady_clock::now()),
+  m_generation_start(m_start),
+  m_generation(0),
+  m_evaluations(0),
+  m_queue_wait(0),
+  m_duration(0),
+  m_length(length)
+{
+  if (m_file.is_open()) {
+    uint32_t const sizes[3] = {length, sizeof(EvaluationRecord),
+      sizeof(GenerationRecord)};
+    m_file.write(TRAINLOG_MAGIC, sizeof(TRAINLOG_MAGIC));
+    m_file.write(reinterpret_cast<char const *>(&TRAINLOG_VERSION),
+        sizeof(TRAINLOG_VERSION));
+    m_file.write(reinterpret_cast<char const *>(sizes), sizeof(sizes));
+  }
+}
+
+inline TrainingLog::~TrainingLog()
+{
+  m_file.flush();
+}
+
+inline uint64_t TrainingLog::GetNanoseconds(
+    std::chrono::steady_clock::duration const &duration) const
+{
+  return static_cast<uint64_t>(std::chrono::duration_cast<
+      std::chrono::nanoseconds>(duration).count());
+}
+
+inline bool TrainingLog::IsOpen() const
+{
+  return m_file.is_open();
+}
+
+// Logs an episode that was requested at start, waited queue_wait for a
+// simulator and then ran for duration.
+inline void TrainingLog::LogEvaluation(std::vector<double> const &genome,
+    uint64_t const seed, double const fitness,
+    std::chrono::steady_clock::time_point const &start,
+    std::chrono::steady_clock::duration const &queue_wait,
+    std::chrono::steady_clock::duration const &duration,
+    uint64_t const ticks, int32_t const slot)
+{
+  EvaluationRecord record;
+  std::memset(&record, 0, sizeof(record));
+  record.kind = EVALUATION;
+  record.generation = m_generation.load();
+  record.seed = seed;
+  record.fitness = fitness;
+  record.start = GetNanoseconds(start - m_start);
+  record.queueWait = GetNanoseconds(queue_wait);
+  record.duration = GetNanoseconds(duration);
+  record.ticks = ticks;
+  record.slot = slot;
+
+  // Genomes of another length are cut or padded with NaN.
+  std::vector<double> genes(m_length, NAN);
+  std::copy(genome.begin(), genome.begin()
+      + std::min<size_t>(genome.size(), m_length), genes.begin());
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_evaluations++;
+  m_queue_wait += record.queueWait;
+  m_duration += record.duration;
+  if (m_file.is_open()) {
+    m_file.write(reinterpret_cast<char const *>(&record), sizeof(record));
+    m_file.write(reinterpret_cast<char const *>(genes.data()),
+        m_length * sizeof(double));
+  }
+}
+
+// Logs the end of a generation with the fitnesses of its candidates, NaN
+// for those not evaluated, and the candidates the optimizer holds after it.
+// Episodes logged from then on belong to the next generation.
+inline void TrainingLog::LogGeneration(uint32_t const generation,
+    std::vector<double> const &fitnesses,
+    std::vector<std::vector<double>> const &population)
+{
+  GenerationRecord record;
+  std::memset(&record, 0, sizeof(record));
+  record.kind = GENERATION;
+  record.generation = generation;
+
+  std::vector<double> sorted;
+  for (double const fitness : fitnesses) {
+    if (!std::isnan(fitness)) {
+      sorted.push_back(fitness);
+    }
+  }
+  std::sort(sorted.begin(), sorted.end());
+  for (uint32_t k{0}; k < 5; k++) {
+    record.fitness[k] = NAN;
+    if (!sorted.empty()) {
+      double const position = 0.25 * k * (sorted.size() - 1);
+      size_t const below = static_cast<size_t>(position);
+      size_t const above = std::min(below + 1, sorted.size() - 1);
+      double const weight = position - static_cast<double>(below);
+      record.fitness[k] = (1.0 - weight) * sorted[below]
+        + weight * sorted[above];
+    }
+  }
+  record.fitnessMean = NAN;
+  if (!sorted.empty()) {
+    double sum{0.0};
+    for (double const fitness : sorted) {
+      sum += fitness;
+    }
+    record.fitnessMean = sum / static_cast<double>(sorted.size());
+  }
+
+  record.diversity = 0.0;
+  if (!population.empty()) {
+    size_t const length = population[0].size();
+    double const count = static_cast<double>(population.size());
+    for (size_t j{0}; j < length; j++) {
+      double mean{0.0};
+      for (auto const &individual : population) {
+        mean += individual[j];
+      }
+      mean /= count;
+      double variance{0.0};
+      for (auto const &individual : population) {
+        variance += (individual[j] - mean) * (individual[j] - mean);
+      }
+      record.diversity += std::sqrt(variance / count);
+    }
+    record.diversity /= std::max<double>(1.0, static_cast<double>(length));
+  }
+
+  auto const now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  record.start = GetNanoseconds(m_generation_start - m_start);
+  record.end = GetNanoseconds(now - m_start);
+  record.evaluations = m_evaluations;
+  record.queueWait = m_queue_wait;
+  record.duration = m_duration;
+  m_generation_start = now;
+  m_evaluations = 0;
+  m_queue_wait = 0;
+  m_duration = 0;
+  m_generation.store(generation + 1);
+  if (m_file.is_open()) {
+    m_file.write(reinterpret_cast<char const *>(&record), sizeof(record));
+    m_file.flush();
+  }
+}
+
+// The generation the following episodes belong to, e.g. after a resume.
+inline void TrainingLog::SetGeneration(uint32_t const generation)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_generation.store(generation);
+  m_generation_start = std::chrono::steady_clock::now();
+}
+
+// Reads a log written by TrainingLog, with the genome of evaluations[i] in
+// genomes[i]. Returns false if the file cannot be opened or was written with
+// a different record layout; a record cut off at the end is ignored.
+inline bool readTrainingLog(std::string const &filename,
+    std::vector<EvaluationRecord> &evaluations,
+    std::vector<std::vector<double>> &genomes,
+    std::vector<GenerationRecord> &generations)
+{
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  char magic[sizeof(TRAINLOG_MAGIC)];
+  uint32_t version{0};
+  uint32_t sizes[3] = {0, 0, 0};
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  file.read(reinterpret_cast<char *>(sizes), sizeof(sizes));
+  if (!file || std::memcmp(magic, TRAINLOG_MAGIC, sizeof(TRAINLOG_MAGIC)) != 0
+      || version != TRAINLOG_VERSION
+      || sizes[1] != sizeof(EvaluationRecord)
+      || sizes[2] != sizeof(GenerationRecord)) {
+    return false;
+  }
+  uint32_t const length = sizes[0];
+
+  // Both records start with their kind.
+  uint32_t kind{0};
+  while (file.read(reinterpret_cast<char *>(&kind), sizeof(kind))) {
+    if (kind == EVALUATION) {
+      EvaluationRecord record;
+      record.kind = kind;
+      std::vector<double> genome(length);
+      file.read(reinterpret_cast<char *>(&record) + sizeof(kind),
+          sizeof(record) - sizeof(kind));
+      file.read(reinterpret_cast<char *>(genome.data()),
+          length * sizeof(double));
+      if (!file) {
+        break;
+      }
+      evaluations.push_back(record);
+      genomes.push_back(genome);
+    } else if (kind == GENERATION) {
+      GenerationRecord record;
+      record.kind = kind;
+      file.read(reinterpret_cast<char *>(&record) + sizeof(kind),
+          sizeof(record) - sizeof(kind));
+      if (!file) {
+        break;
+      }
+      generations.push_back(record);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,634 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_OD4SESSION_HPP
+#define TME290_OD4SESSION_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cluon-complete.hpp"
+#include "tme290-sim-grass-msg.hpp"
+
+namespace tme290 {
+namespace od4 {
+
+// An OD4 Envelope whose payload still points into the received datagram.
+// Only valid for the duration of the delegate call.
+struct RawEnvelope {
+  int32_t dataType{0};
+  char const *payload{nullptr};
+  uint32_t payloadSize{0};
+  int32_t sentSeconds{0};
+  int32_t sentMicroseconds{0};
+  int32_t sampleTimeStampSeconds{0};
+  int32_t sampleTimeStampMicroseconds{0};
+  uint32_t senderStamp{0};
+  std::chrono::system_clock::time_point received{};
+};
+
+class SensorsView;
+bool decodeSensors(char const *, uint32_t, SensorsView &);
+
+// Plain copy of tme290::grass::Sensors with the same accessors, filled in by
+// decodeSensors without touching the heap.
+class SensorsView {
+  public:
+    uint32_t i() const { return m_i; }
+    uint32_t j() const { return m_j; }
+    uint64_t time() const { return m_time; }
+    float grassTopLeft() const { return m_grass[0]; }
+    float grassTopCentre() const { return m_grass[1]; }
+    float grassTopRight() const { return m_grass[2]; }
+    float grassLeft() const { return m_grass[3]; }
+    float grassCentre() const { return m_grass[4]; }
+    float grassRight() const { return m_grass[5]; }
+    float grassBottomLeft() const { return m_grass[6]; }
+    float grassBottomCentre() const { return m_grass[7]; }
+    float grassBottomRight() const { return m_grass[8]; }
+    float rain() const { return m_rain; }
+    float battery() const { return m_battery; }
+    float rainCloudDirX() const { return m_rainCloudDirX; }
+    float rainCloudDirY() const { return m_rainCloudDirY; }
+
+  private:
+    friend bool decodeSensors(char const *, uint32_t, SensorsView &);
+
+    uint64_t m_time{0};
+    uint32_t m_i{0};
+    uint32_t m_j{0};
+    float m_grass[9]{};
+    float m_rain{0.0f};
+    float m_battery{0.0f};
+    float m_rainCloudDirX{0.0f};
+    float m_rainCloudDirY{0.0f};
+};
+
+namespace {
+uint8_t const OD4_HEADER_SIZE{5};
+uint8_t const WIRE_VARINT{0};
+uint8_t const WIRE_EIGHT_BYTES{1};
+uint8_t const WIRE_LENGTH_DELIMITED{2};
+uint8_t const WIRE_FOUR_BYTES{5};
+
+inline bool readVarInt(char const *&p, char const *end, uint64_t &value)
+{
+  value = 0;
+  for (uint32_t shift{0}; p < end && shift < 64; shift += 7) {
+    uint8_t const b = static_cast<uint8_t>(*p++);
+    value |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline int32_t fromZigZag32(uint64_t value)
+{
+  uint32_t const v = static_cast<uint32_t>(value);
+  return static_cast<int32_t>((v >> 1) ^ (~(v & 1) + 1));
+}
+
+inline bool readFloat(char const *&p, char const *end, float &value)
+{
+  if (end - p < 4) {
+    return false;
+  }
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  v = le32toh(v);
+  std::memcpy(&value, &v, sizeof(value));
+  p += 4;
+  return true;
+}
+
+// Steps over a field of the given wire type that the caller is not
+// interested in.
+inline bool skipField(char const *&p, char const *end, uint8_t wireType)
+{
+  uint64_t length{0};
+  switch (wireType) {
+    case WIRE_VARINT:
+      return readVarInt(p, end, length);
+    case WIRE_EIGHT_BYTES:
+      length = 8;
+      break;
+    case WIRE_FOUR_BYTES:
+      length = 4;
+      break;
+    case WIRE_LENGTH_DELIMITED:
+      if (!readVarInt(p, end, length)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+  if (static_cast<uint64_t>(end - p) < length) {
+    return false;
+  }
+  p += length;
+  return true;
+}
+
+inline bool decodeTimeStamp(char const *p, char const *end, int32_t &seconds,
+    int32_t &microseconds)
+{
+  while (p < end) {
+    uint64_t key;
+    if (!readVarInt(p, end, key)) {
+      return false;
+    }
+    uint8_t const wireType = key & 0x7;
+    uint64_t const field = key >> 3;
+    if (wireType == WIRE_VARINT && (field == 1 || field == 2)) {
+      uint64_t value;
+      if (!readVarInt(p, end, value)) {
+        return false;
+      }
+      (field == 1 ? seconds : microseconds) = fromZigZag32(value);
+    } else if (!skipField(p, end, wireType)) {
+      return false;
+    }
+  }
+  return true;
+}
+}
+
+// Parses an OD4 datagram (0x0D 0xA4 LEN0 LEN1 LEN2 followed by a
+// Proto-encoded cluon::data::Envelope) in place.
+inline bool decodeEnvelope(char const *data, uint32_t size,
+    RawEnvelope &envelope)
+{
+  if (size < OD4_HEADER_SIZE || static_cast<uint8_t>(data[0]) != 0x0D
+      || static_cast<uint8_t>(data[1]) != 0xA4) {
+    return false;
+  }
+  uint32_t const length = static_cast<uint8_t>(data[2])
+    | (static_cast<uint8_t>(data[3]) << 8)
+    | (static_cast<uint8_t>(data[4]) << 16);
+  if (size - OD4_HEADER_SIZE < length) {
+    return false;
+  }
+
+  envelope = RawEnvelope();
+  char const *p = data + OD4_HEADER_SIZE;
+  char const *end = p + length;
+  while (p < end) {
+    uint64_t key;
+    if (!readVarInt(p, end, key)) {
+      return false;
+    }
+    uint8_t const wireType = key & 0x7;
+    uint64_t const field = key >> 3;
+    uint64_t value{0};
+    if (wireType == WIRE_VARINT && (field == 1 || field == 6)) {
+      if (!readVarInt(p, end, value)) {
+        return false;
+      }
+      if (field == 1) {
+        envelope.dataType = fromZigZag32(value);
+      } else {
+        envelope.senderStamp = static_cast<uint32_t>(value);
+      }
+    } else if (wireType == WIRE_LENGTH_DELIMITED && field >= 2 && field <= 5) {
+      if (!readVarInt(p, end, value)
+          || static_cast<uint64_t>(end - p) < value) {
+        return false;
+      }
+      char const *fieldEnd = p + value;
+      if (field == 2) {
+        envelope.payload = p;
+        envelope.payloadSize = static_cast<uint32_t>(value);
+      } else if (field == 3) {
+        decodeTimeStamp(p, fieldEnd, envelope.sentSeconds,
+            envelope.sentMicroseconds);
+      } else if (field == 5) {
+        decodeTimeStamp(p, fieldEnd, envelope.sampleTimeStampSeconds,
+            envelope.sampleTimeStampMicroseconds);
+      }
+      p = fieldEnd;
+    } else if (!skipField(p, end, wireType)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes a Proto-encoded tme290::grass::Sensors payload.
+inline bool decodeSensors(char const *data, uint32_t size,
+    SensorsView &sensors)
+{
+  sensors = SensorsView();
+  char const *p = data;
+  char const *end = data + size;
+  while (p < end) {
+    uint64_t key;
+    if (!readVarInt(p, end, key)) {
+      return false;
+    }
+    uint8_t const wireType = key & 0x7;
+    uint64_t const field = key >> 3;
+    bool ok{true};
+    if (wireType == WIRE_VARINT && field >= 1 && field <= 3) {
+      uint64_t value;
+      ok = readVarInt(p, end, value);
+      if (field == 1) {
+        sensors.m_i = static_cast<uint32_t>(value);
+      } else if (field == 2) {
+        sensors.m_j = static_cast<uint32_t>(value);
+      } else {
+        sensors.m_time = value;
+      }
+    } else if (wireType == WIRE_FOUR_BYTES && field >= 4 && field <= 12) {
+      ok = readFloat(p, end, sensors.m_grass[field - 4]);
+    } else if (wireType == WIRE_FOUR_BYTES && field == 13) {
+      ok = readFloat(p, end, sensors.m_rain);
+    } else if (wireType == WIRE_FOUR_BYTES && field == 14) {
+      ok = readFloat(p, end, sensors.m_battery);
+    } else if (wireType == WIRE_FOUR_BYTES && field == 15) {
+      ok = readFloat(p, end, sensors.m_rainCloudDirX);
+    } else if (wireType == WIRE_FOUR_BYTES && field == 16) {
+      ok = readFloat(p, end, sensors.m_rainCloudDirY);
+    } else {
+      ok = skipField(p, end, wireType);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Proto encoder writing into a caller-owned buffer. Once the buffer is full,
+// further writes are ignored and IsOverflowed() returns true.
+class ProtoWriter {
+  public:
+    ProtoWriter(char *, uint32_t const);
+    virtual ~ProtoWriter();
+    uint32_t GetSize() const;
+    bool IsOverflowed() const;
+    void WriteBytes(uint32_t const, char const *, uint32_t const);
+    void WriteFloat(uint32_t const, float const);
+    void WriteSigned(uint32_t const, int32_t const);
+    void WriteUnsigned(uint32_t const, uint64_t const);
+
+  private:
+    ProtoWriter(ProtoWriter const &);
+    ProtoWriter &operator=(ProtoWriter const &);
+    void Put(char const *, uint32_t const);
+    void PutVarInt(uint64_t);
+
+    char *m_data;
+    uint32_t const m_capacity;
+    uint32_t m_size;
+    bool m_overflowed;
+};
+
+inline ProtoWriter::ProtoWriter(char *data, uint32_t const capacity):
+  m_data(data),
+  m_capacity(capacity),
+  m_size(0),
+  m_overflowed(false)
+{
+}
+
+inline ProtoWriter::~ProtoWriter()
+{
+}
+
+inline uint32_t ProtoWriter::GetSize() const
+{
+  return m_size;
+}
+
+inline bool ProtoWriter::IsOverflowed() const
+{
+  return m_overflowed;
+}
+
+inline void ProtoWriter::Put(char const *data, uint32_t const size)
+{
+  if (m_overflowed || m_capacity - m_size < size) {
+    m_overflowed = true;
+    return;
+  }
+  std::memcpy(m_data + m_size, data, size);
+  m_size += size;
+}
+
+inline void ProtoWriter::PutVarInt(uint64_t value)
+{
+  char bytes[10];
+  uint32_t count{0};
+  while (value > 0x7f) {
+    bytes[count++] = static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  bytes[count++] = static_cast<char>(value);
+  Put(bytes, count);
+}
+
+inline void ProtoWriter::WriteBytes(uint32_t const field, char const *data,
+    uint32_t const size)
+{
+  PutVarInt((field << 3) | WIRE_LENGTH_DELIMITED);
+  PutVarInt(size);
+  Put(data, size);
+}
+
+inline void ProtoWriter::WriteFloat(uint32_t const field, float const value)
+{
+  uint32_t v;
+  std::memcpy(&v, &value, sizeof(v));
+  v = htole32(v);
+  PutVarInt((field << 3) | WIRE_FOUR_BYTES);
+  Put(reinterpret_cast<char const *>(&v), sizeof(v));
+}
+
+inline void ProtoWriter::WriteSigned(uint32_t const field, int32_t const value)
+{
+  uint32_t const zigzag = (static_cast<uint32_t>(value) << 1) 
+    ^ static_cast<uint32_t>(value >> 31);
+  WriteUnsigned(field, zigzag);
+}
+
+inline void ProtoWriter::WriteUnsigned(uint32_t const field,
+    uint64_t const value)
+{
+  PutVarInt((field << 3) | WIRE_VARINT);
+  PutVarInt(value);
+}
+
+// Writes a complete OD4 datagram (header and Envelope) around an already
+// encoded payload, field by field in the same order as cluon. Returns the
+// datagram size, or 0 if it does not fit.
+inline uint32_t encodeEnvelope(char *buffer, uint32_t const capacity,
+    int32_t const dataType, char const *payload, uint32_t const payloadSize,
+    int32_t const sentSeconds, int32_t const sentMicroseconds,
+    uint32_t const senderStamp)
+{
+  if (capacity < OD4_HEADER_SIZE) {
+    return 0;
+  }
+
+  char timeStamp[16];
+  ProtoWriter sent(timeStamp, sizeof(timeStamp));
+  sent.WriteSigned(1, sentSeconds);
+  sent.WriteSigned(2, sentMicroseconds);
+  char emptyTimeStamp[4];
+  ProtoWriter received(emptyTimeStamp, sizeof(emptyTimeStamp));
+  received.WriteSigned(1, 0);
+  received.WriteSigned(2, 0);
+
+  ProtoWriter envelope(buffer + OD4_HEADER_SIZE, capacity - OD4_HEADER_SIZE);
+  envelope.WriteSigned(1, dataType);
+  envelope.WriteBytes(2, payload, payloadSize);
+  envelope.WriteBytes(3, timeStamp, sent.GetSize());
+  envelope.WriteBytes(4, emptyTimeStamp, received.GetSize());
+  envelope.WriteBytes(5, timeStamp, sent.GetSize());
+  envelope.WriteUnsigned(6, senderStamp);
+  if (envelope.IsOverflowed() || envelope.GetSize() > 0xffffff) {
+    return 0;
+  }
+
+  uint32_t const length = envelope.GetSize();
+  buffer[0] = static_cast<char>(0x0D);
+  buffer[1] = static_cast<char>(0xA4);
+  buffer[2] = static_cast<char>(length & 0xff);
+  buffer[3] = static_cast<char>((length >> 8) & 0xff);
+  buffer[4] = static_cast<char>((length >> 16) & 0xff);
+  return OD4_HEADER_SIZE + length;
+}
+
+inline uint32_t encodeControl(tme290::grass::Control const &control,
+    char *buffer, uint32_t const capacity)
+{
+  ProtoWriter writer(buffer, capacity);
+  writer.WriteUnsigned(1, control.command());
+  return writer.IsOverflowed() ? 0 : writer.GetSize();
+}
+
+inline uint32_t encodeRestart(tme290::grass::Restart const &restart,
+    char *buffer, uint32_t const capacity)
+{
+  ProtoWriter writer(buffer, capacity);
+  writer.WriteUnsigned(1, restart.seed());
+  return writer.IsOverflowed() ? 0 : writer.GetSize();
+}
+
+// A drop-in replacement for cluon::OD4Session where each message type can be
+// handled either by a regular Envelope delegate or by a RawEnvelope delegate
+// that decodes directly from the received bytes. Envelopes are only built for
+// message types that were registered with an Envelope delegate.
+class Session {
+  public:
+    Session(uint16_t const);
+    virtual ~Session();
+    bool dataTrigger(int32_t,
+        std::function<void(cluon::data::Envelope &&)>);
+    bool dataTrigger(int32_t, std::function<void(RawEnvelope const &)>);
+    bool isRunning();
+    void send(tme290::grass::Control &);
+    void send(tme290::grass::Restart &);
+    template <typename T> void send(T &);
+
+  private:
+    Session(Session const &);
+    Session &operator=(Session const &);
+    void Callback(std::string &&, std::chrono::system_clock::time_point &&);
+    void SendPayload(int32_t const, uint32_t const);
+
+    struct Trigger {
+      int32_t dataType;
+      std::function<void(cluon::data::Envelope &&)> envelopeDelegate;
+      std::function<void(RawEnvelope const &)> rawDelegate;
+    };
+
+    cluon::UDPSender m_sender;
+    std::mutex m_sender_mutex;
+    std::string m_send_buffer;
+    char m_payload_buffer[64];
+    std::mutex m_triggers_mutex;
+    std::vector<Trigger> m_triggers;
+    std::unique_ptr<cluon::UDPReceiver> m_receiver;
+};
+
+namespace {
+// Room for the envelope around the largest payload.
+uint32_t const SEND_BUFFER_SIZE = 256;
+}
+
+inline Session::Session(uint16_t const cid):
+  m_sender("225.0.0." + std::to_string(cid), 12175),
+  m_sender_mutex(),
+  m_send_buffer(),
+  m_payload_buffer(),
+  m_triggers_mutex(),
+  m_triggers(),
+  m_receiver(nullptr)
+{
+  m_send_buffer.reserve(SEND_BUFFER_SIZE);
+  m_receiver.reset(new cluon::UDPReceiver("225.0.0." + std::to_string(cid),
+        12175, [this](std::string &&data, std::string &&,
+          std::chrono::system_clock::time_point &&timepoint) {
+          Callback(std::move(data), std::move(timepoint));
+        }, m_sender.getSendFromPort()));
+}
+
+inline Session::~Session()
+{
+  m_receiver.reset();
+}
+
+inline void Session::Callback(std::string &&data,
+    std::chrono::system_clock::time_point &&timepoint)
+{
+  RawEnvelope raw;
+  if (!decodeEnvelope(data.data(), static_cast<uint32_t>(data.size()), raw)) {
+    return;
+  }
+  raw.received = timepoint;
+
+  std::lock_guard<std::mutex> lock(m_triggers_mutex);
+  for (auto const &trigger : m_triggers) {
+    if (trigger.dataType != raw.dataType) {
+      continue;
+    }
+    if (trigger.rawDelegate != nullptr) {
+      trigger.rawDelegate(raw);
+    } else {
+      std::stringstream sstr(data);
+      auto envelope = cluon::extractEnvelope(sstr);
+      if (envelope.first) {
+        envelope.second.received(cluon::time::convert(timepoint));
+        trigger.envelopeDelegate(std::move(envelope.second));
+      }
+    }
+    break;
+  }
+}
+
+inline bool Session::dataTrigger(int32_t dataType,
+    std::function<void(cluon::data::Envelope &&)> delegate)
+{
+  std::lock_guard<std::mutex> lock(m_triggers_mutex);
+  for (auto it = m_triggers.begin(); it != m_triggers.end(); ++it) {
+    if (it->dataType == dataType) {
+      m_triggers.erase(it);
+      break;
+    }
+  }
+  if (delegate != nullptr) {
+    m_triggers.push_back(Trigger{dataType, delegate, nullptr});
+  }
+  return true;
+}
+
+inline bool Session::dataTrigger(int32_t dataType,
+    std::function<void(RawEnvelope const &)> delegate)
+{
+  std::lock_guard<std::mutex> lock(m_triggers_mutex);
+  for (auto it = m_triggers.begin(); it != m_triggers.end(); ++it) {
+    if (it->dataType == dataType) {
+      m_triggers.erase(it);
+      break;
+    }
+  }
+  if (delegate != nullptr) {
+    m_triggers.push_back(Trigger{dataType, nullptr, delegate});
+  }
+  return true;
+}
+
+inline bool Session::isRunning()
+{
+  return m_receiver->isRunning();
+}
+
+// Control and Restart are encoded into buffers owned by the session, so
+// sending them does not allocate.
+inline void Session::send(tme290::grass::Control &control)
+{
+  std::lock_guard<std::mutex> lock(m_sender_mutex);
+  SendPayload(tme290::grass::Control::ID(), encodeControl(control,
+        m_payload_buffer, sizeof(m_payload_buffer)));
+}
+
+inline void Session::send(tme290::grass::Restart &restart)
+{
+  std::lock_guard<std::mutex> lock(m_sender_mutex);
+  SendPayload(tme290::grass::Restart::ID(), encodeRestart(restart,
+        m_payload_buffer, sizeof(m_payload_buffer)));
+}
+
+inline void Session::SendPayload(int32_t const dataType,
+    uint32_t const payloadSize)
+{
+  auto const now = std::chrono::system_clock::now().time_since_epoch();
+  int64_t const microseconds = 
+    std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+
+  // Stays within the reserved capacity, so resize does not reallocate. The
+  // buffer is handed to UDPSender::send as an rvalue; should that ever take
+  // its memory, room is reserved again instead of encoding into nothing.
+  if (m_send_buffer.capacity() < SEND_BUFFER_SIZE) {
+    m_send_buffer.reserve(SEND_BUFFER_SIZE);
+  }
+  m_send_buffer.resize(m_send_buffer.capacity());
+  uint32_t const size = encodeEnvelope(&m_send_buffer[0],
+      static_cast<uint32_t>(m_send_buffer.size()), dataType,
+      m_payload_buffer, payloadSize,
+      static_cast<int32_t>(microseconds / 1000000),
+      static_cast<int32_t>(microseconds % 1000000), 0);
+  if (size == 0) {
+    return;
+  }
+  m_send_buffer.resize(size);
+
+  // UDPSender::send currently only reads from the string, so the buffer
+  // keeps its capacity.
+  m_sender.send(std::move(m_send_buffer));
+}
+
+template <typename T>
+inline void Session::send(T &message)
+{
+  std::lock_guard<std::mutex> lock(m_sender_mutex);
+  cluon::ToProtoVisitor protoEncoder;
+  cluon::data::Envelope envelope;
+  envelope.dataType(static_cast<int32_t>(message.ID()));
+  message.accept(protoEncoder);
+  envelope.serializedData(protoEncoder.encodedData());
+  envelope.sent(cluon::time::now());
+  envelope.sampleTimeStamp(envelope.sent());
+  m_sender.send(cluon::serializeEnvelope(std::move(envelope)));
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_SIM_GRASS_BATCH_HPP
+#define TME290_SIM_GRASS_BATCH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "tme290-sim-grass-msg.hpp"
+#include "tme290-sim-grass.hpp"
+
+namespace tme290 {
+namespace grass {
+
+// Runs many episodes of the grass simulator side by side. All episode state is
+// kept in structure-of-arrays form so that one call to Step advances every
+// active episode by one tick. The episodes are still stepped one after the
+// other; nothing is vectorised across them. Within an episode the grass grows
+// in contiguous per-row loops, of which GCC at -O2 vectorises those for rows
+// outside the rain cloud. Given the same seed, an episode evolves exactly as
+// it would in Simulator.
+class BatchSimulator {
+  public:
+    static uint32_t const CELL_COUNT =
+      Simulator::GRID_SIZE * Simulator::GRID_SIZE;
+
+    BatchSimulator(std::vector<uint32_t> const &);
+    virtual ~BatchSimulator();
+    uint32_t GetActiveCount() const;
+    std::vector<float> const &GetBattery() const;
+    uint32_t GetEpisodeCount() const;
+    std::vector<int32_t> const &GetI() const;
+    std::vector<int32_t> const &GetJ() const;
+    Sensors GetSensors(uint32_t const) const;
+    Status GetStatus(uint32_t const) const;
+    std::vector<uint64_t> const &GetTime() const;
+    bool IsActive(uint32_t const) const;
+    void Restart(uint32_t const, uint32_t const);
+    void SetActive(uint32_t const, bool const);
+    void Step(std::vector<uint8_t> const &);
+
+  private:
+    BatchSimulator(BatchSimulator const &);
+    BatchSimulator &operator=(BatchSimulator const &);
+    float GetGrass(uint32_t const, int32_t, int32_t) const;
+    void GrowGrass(uint32_t const);
+    void MoveMowers(std::vector<uint8_t> const &);
+
+    std::vector<std::default_random_engine> m_generators;
+    std::vector<float> m_grass;
+    std::vector<float> m_rain_row;
+    std::vector<uint64_t> m_time;
+    std::vector<float> m_battery;
+    std::vector<float> m_cloud_dir_x;
+    std::vector<float> m_cloud_dir_y;
+    std::vector<float> m_cloud_x;
+    std::vector<float> m_cloud_y;
+    std::vector<int32_t> m_i;
+    std::vector<int32_t> m_j;
+    std::vector<uint8_t> m_active;
+    uint32_t const m_episode_count;
+};
+
+inline BatchSimulator::BatchSimulator(std::vector<uint32_t> const &seeds):
+  m_generators(seeds.size()),
+  m_grass(seeds.size() * CELL_COUNT, 0.0f),
+  m_rain_row(Simulator::GRID_SIZE, 0.0f),
+  m_time(seeds.size(), 0),
+  m_battery(seeds.size(), 1.0f),
+  m_cloud_dir_x(seeds.size(), 0.0f),
+  m_cloud_dir_y(seeds.size(), 0.0f),
+  m_cloud_x(seeds.size(), 0.0f),
+  m_cloud_y(seeds.size(), 0.0f),
+  m_i(seeds.size(), 0),
+  m_j(seeds.size(), 0),
+  m_active(seeds.size(), 1),
+  m_episode_count(static_cast<uint32_t>(seeds.size()))
+{
+  for (uint32_t k{0}; k < m_episode_count; k++) {
+    Restart(k, seeds[k]);
+  }
+}
+
+inline BatchSimulator::~BatchSimulator()
+{
+}
+
+inline uint32_t BatchSimulator::GetActiveCount() const
+{
+  return static_cast<uint32_t>(std::count(m_active.begin(), m_active.end(),
+        1));
+}
+
+inline std::vector<float> const &BatchSimulator::GetBattery() const
+{
+  return m_battery;
+}
+
+inline uint32_t BatchSimulator::GetEpisodeCount() const
+{
+  return m_episode_count;
+}
+
+inline float BatchSimulator::GetGrass(uint32_t const k, int32_t i,
+    int32_t j) const
+{
+  if (isWall(i, j)) {
+    return OUTSIDE;
+  }
+  return m_grass[k * CELL_COUNT + j * Simulator::GRID_SIZE + i];
+}
+
+inline std::vector<int32_t> const &BatchSimulator::GetI() const
+{
+  return m_i;
+}
+
+inline std::vector<int32_t> const &BatchSimulator::GetJ() const
+{
+  return m_j;
+}
+
+inline Sensors BatchSimulator::GetSensors(uint32_t const k) const
+{
+  int32_t const i = m_i[k];
+  int32_t const j = m_j[k];
+
+  Sensors sensors;
+  sensors.i(i);
+  sensors.j(j);
+  sensors.time(m_time[k]);
+  sensors.grassTopLeft(GetGrass(k, i - 1, j - 1));
+  sensors.grassTopCentre(GetGrass(k, i, j - 1));
+  sensors.grassTopRight(GetGrass(k, i + 1, j - 1));
+  sensors.grassLeft(GetGrass(k, i - 1, j));
+  sensors.grassCentre(GetGrass(k, i, j));
+  sensors.grassRight(GetGrass(k, i + 1, j));
+  sensors.grassBottomLeft(GetGrass(k, i - 1, j + 1));
+  sensors.grassBottomCentre(GetGrass(k, i, j + 1));
+  sensors.grassBottomRight(GetGrass(k, i + 1, j + 1));
+  sensors.rain(rainAt(i, j, m_cloud_x[k], m_cloud_y[k]));
+  sensors.battery(m_battery[k]);
+  sensors.rainCloudDirX(m_cloud_dir_x[k]);
+  sensors.rainCloudDirY(m_cloud_dir_y[k]);
+  return sensors;
+}
+
+inline Status BatchSimulator::GetStatus(uint32_t const k) const
+{
+  float grassMax{0.0f};
+  double grassSum{0.0};
+  uint32_t cellCount{0};
+  float const *grid = &m_grass[k * CELL_COUNT];
+  for (int32_t j{0}; j < static_cast<int32_t>(Simulator::GRID_SIZE); j++) {
+    for (int32_t i{0}; i < static_cast<int32_t>(Simulator::GRID_SIZE); i++) {
+      if (isWall(i, j)) {
+        continue;
+      }
+      float const grass = grid[j * Simulator::GRID_SIZE + i];
+      grassMax = std::max(grassMax, grass);
+      grassSum += grass;
+      cellCount++;
+    }
+  }
+
+  Status status;
+  status.time(m_time[k]);
+  status.grassMax(grassMax);
+  status.grassMean(static_cast<float>(grassSum / cellCount));
+  return status;
+}
+
+inline std::vector<uint64_t> const &BatchSimulator::GetTime() const
+{
+  return m_time;
+}
+
+// Rain only falls within CLOUD_RADIUS of the cloud centre, so the rain term is
+// evaluated for the covered cells only and added through a scratch row that is
+// zero elsewhere. Adding a zero rain term leaves the sum unchanged, which keeps
+// the result identical to Simulator::Step.
+inline void BatchSimulator::GrowGrass(uint32_t const k)
+{
+  int32_t const size = static_cast<int32_t>(Simulator::GRID_SIZE);
+  float const cloud_x = m_cloud_x[k];
+  float const cloud_y = m_cloud_y[k];
+  int32_t const i_min = std::max(0,
+      static_cast<int32_t>(std::floor(cloud_x - CLOUD_RADIUS)));
+  int32_t const i_max = std::min(size - 1,
+      static_cast<int32_t>(std::ceil(cloud_x + CLOUD_RADIUS)));
+  int32_t const j_min = std::max(0,
+      static_cast<int32_t>(std::floor(cloud_y - CLOUD_RADIUS)));
+  int32_t const j_max = std::min(size - 1,
+      static_cast<int32_t>(std::ceil(cloud_y + CLOUD_RADIUS)));
+
+  float *grid = &m_grass[k * CELL_COUNT];
+  float *rain = m_rain_row.data();
+  for (int32_t j{0}; j < size; j++) {
+    float *row = grid + j * size;
+    if (j < j_min || j > j_max || i_min > i_max) {
+      for (int32_t i{0}; i < size; i++) {
+        row[i] = std::min(1.0f, row[i] + GRASS_GROWTH);
+      }
+      continue;
+    }
+
+    for (int32_t i{i_min}; i <= i_max; i++) {
+      rain[i] = rainAt(i, j, cloud_x, cloud_y);
+    }
+    for (int32_t i{0}; i < size; i++) {
+      row[i] = std::min(1.0f, row[i] + GRASS_GROWTH
+          + GRASS_GROWTH_RAIN * rain[i]);
+    }
+    for (int32_t i{i_min}; i <= i_max; i++) {
+      rain[i] = 0.0f;
+    }
+  }
+}
+
+inline bool BatchSimulator::IsActive(uint32_t const k) const
+{
+  return m_active[k] != 0;
+}
+
+inline void BatchSimulator::MoveMowers(std::vector<uint8_t> const &commands)
+{
+  for (uint32_t k{0}; k < m_episode_count; k++) {
+    if (!m_active[k] || m_battery[k] <= 0.0f) {
+      continue;
+    }
+    uint8_t const command = (commands[k] < 9) ? commands[k] : 0;
+    int32_t const i = m_i[k] + MOVE_DI[command];
+    int32_t const j = m_j[k] + MOVE_DJ[command];
+    if (!isWall(i, j)) {
+      m_i[k] = i;
+      m_j[k] = j;
+    }
+    m_battery[k] -= (command == 0) ? BATTERY_DRAIN_STAY : BATTERY_DRAIN_MOVE;
+
+    float const rain = rainAt(m_i[k], m_j[k], m_cloud_x[k], m_cloud_y[k]);
+    float &grass = m_grass[k * CELL_COUNT + m_j[k] * Simulator::GRID_SIZE
+      + m_i[k]];
+    grass = std::max(0.0f, grass - GRASS_CUT * (1.0f - 0.5f * rain));
+  }
+}
+
+inline void BatchSimulator::Restart(uint32_t const k, uint32_t const seed)
+{
+  std::default_random_engine &generator = m_generators[k];
+  generator.seed(seed);
+  std::uniform_real_distribution<float> grass_distribution(0.0f,
+      GRASS_INITIAL_MAX);
+  float *grid = &m_grass[k * CELL_COUNT];
+  for (uint32_t c{0}; c < CELL_COUNT; c++) {
+    grid[c] = grass_distribution(generator);
+  }
+  m_time[k] = 0;
+  m_battery[k] = 1.0f;
+  m_i[k] = 0;
+  m_j[k] = 0;
+  m_active[k] = 1;
+  spawnRainCloud(generator, m_cloud_x[k], m_cloud_y[k], m_cloud_dir_x[k],
+      m_cloud_dir_y[k]);
+}
+
+inline void BatchSimulator::SetActive(uint32_t const k, bool const active)
+{
+  m_active[k] = active ? 1 : 0;
+}
+
+// Advances every active episode one tick, using commands[k] for episode k.
+// Inactive episodes are left untouched.
+inline void BatchSimulator::Step(std::vector<uint8_t> const &commands)
+{
+  MoveMowers(commands);
+
+  float const limit = static_cast<float>(Simulator::GRID_SIZE) + CLOUD_RADIUS;
+  for (uint32_t k{0}; k < m_episode_count; k++) {
+    if (!m_active[k]) {
+      continue;
+    }
+
+    if (m_i[k] == 0 && m_j[k] == 0) {
+      m_battery[k] = std::min(1.0f, m_battery[k] + BATTERY_CHARGE);
+    }
+    m_battery[k] = std::max(0.0f, m_battery[k]);
+
+    GrowGrass(k);
+
+    m_cloud_x[k] += CLOUD_SPEED * m_cloud_dir_x[k];
+    m_cloud_y[k] += CLOUD_SPEED * m_cloud_dir_y[k];
+    if (m_cloud_x[k] < -CLOUD_RADIUS || m_cloud_x[k] > limit
+        || m_cloud_y[k] < -CLOUD_RADIUS || m_cloud_y[k] > limit) {
+      spawnRainCloud(m_generators[k], m_cloud_x[k], m_cloud_y[k],
+          m_cloud_dir_x[k], m_cloud_dir_y[k]);
+    }
+
+    m_time[k]++;
+  }
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TME290_SIM_GRASS_HPP
+#define TME290_SIM_GRASS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "tme290-sim-grass-msg.hpp"
+
+namespace tme290 {
+namespace grass {
+
+// In-process version of the grass simulator. It follows the same message
+// contract as the networked simulator: a Control command moves the mower one
+// tick and is answered with Sensors, Status summarises the lawn and Restart
+// resets the episode with a new seed. The source of the networked simulator
+// is not part of this repository, so the lawn layout and the dynamics below
+// are an approximation of it, not a copy; fitness values from the two are
+// comparable in trend only.
+class Simulator {
+  public:
+    // The wall is an approximation too, a single row from the left edge.
+    static uint32_t const GRID_SIZE = 40;
+    static uint32_t const WALL_ROW = 17;
+    static uint32_t const WALL_END = 23;
+
+    Simulator(uint32_t const);
+    virtual ~Simulator();
+    Sensors GetSensors() const;
+    Status GetStatus() const;
+    uint64_t GetTime() const;
+    bool IsWall(int32_t, int32_t) const;
+    void Restart(uint32_t const);
+    void Restart(tme290::grass::Restart const &);
+    Sensors Step(Control const &);
+
+  private:
+    Simulator(Simulator const &);
+    Simulator &operator=(Simulator const &);
+    float GetGrass(int32_t, int32_t) const;
+    float GetRain(int32_t, int32_t) const;
+    void MoveRainCloud();
+    void SpawnRainCloud();
+
+    std::default_random_engine m_generator;
+    std::vector<float> m_grass;
+    uint64_t m_time;
+    float m_battery;
+    float m_cloud_dir_x;
+    float m_cloud_dir_y;
+    float m_cloud_x;
+    float m_cloud_y;
+    int32_t m_i;
+    int32_t m_j;
+};
+
+// None of these constants are taken from the networked simulator. They were
+// chosen so that an episode resembles one observed through its Sensors: the
+// grass is cut down in one or two passes, rain visibly speeds up growth and
+// a full battery lasts a few hundred moves.
+namespace {
+// Growth per tick of every cell, plus the extra growth under the cloud
+// centre.
+float const GRASS_GROWTH{0.0005f};
+float const GRASS_GROWTH_RAIN{0.002f};
+// Height removed from the cell the mower stands on, halved under the cloud
+// centre, and the highest grass a new lawn starts with.
+float const GRASS_CUT{0.25f};
+float const GRASS_INITIAL_MAX{0.3f};
+// Battery gained per tick at home, and used per tick moving or standing.
+float const BATTERY_CHARGE{0.02f};
+float const BATTERY_DRAIN_MOVE{0.0025f};
+float const BATTERY_DRAIN_STAY{0.001f};
+// Radius in cells of the rain cloud, and its speed in cells per tick.
+float const CLOUD_RADIUS{8.0f};
+float const CLOUD_SPEED{0.1f};
+float const OUTSIDE{-1.0f};
+float const PI{3.14159265f};
+int32_t const MOVE_DI[9] = {0, -1, 0, 1, 1, 1, 0, -1, -1};
+int32_t const MOVE_DJ[9] = {0, -1, -1, -1, 0, 1, 1, 1, 0};
+
+inline bool isWall(int32_t i, int32_t j)
+{
+  int32_t const size = static_cast<int32_t>(Simulator::GRID_SIZE);
+  if (i < 0 || j < 0 || i >= size || j >= size) {
+    return true;
+  }
+  return (j == static_cast<int32_t>(Simulator::WALL_ROW)
+      && i <= static_cast<int32_t>(Simulator::WALL_END));
+}
+
+inline float rainAt(int32_t i, int32_t j, float cloud_x, float cloud_y)
+{
+  float const dx = static_cast<float>(i) - cloud_x;
+  float const dy = static_cast<float>(j) - cloud_y;
+  float const d = std::sqrt(dx * dx + dy * dy);
+  return (d < CLOUD_RADIUS) ? 1.0f - d / CLOUD_RADIUS : 0.0f;
+}
+
+// The cloud enters from a random point on the lawn border and drifts roughly
+// across it.
+inline void spawnRainCloud(std::default_random_engine &generator,
+    float &cloud_x, float &cloud_y, float &cloud_dir_x, float &cloud_dir_y)
+{
+  float const size = static_cast<float>(Simulator::GRID_SIZE);
+  std::uniform_real_distribution<float> position_distribution(0.0f, size);
+  std::uniform_real_distribution<float> angle_distribution(-0.5f, 0.5f);
+
+  float const x = position_distribution(generator);
+  float const y = position_distribution(generator);
+  float angle{0.0f};
+  switch (generator() % 4) {
+    case 0:
+      cloud_x = -CLOUD_RADIUS;
+      cloud_y = y;
+      break;
+    case 1:
+      cloud_x = size + CLOUD_RADIUS;
+      cloud_y = y;
+      angle = PI;
+      break;
+    case 2:
+      cloud_x = x;
+      cloud_y = -CLOUD_RADIUS;
+      angle = PI / 2.0f;
+      break;
+    default:
+      cloud_x = x;
+      cloud_y = size + CLOUD_RADIUS;
+      angle = -PI / 2.0f;
+      break;
+  }
+  angle += angle_distribution(generator);
+  cloud_dir_x = std::cos(angle);
+  cloud_dir_y = std::sin(angle);
+}
+}
+
+inline Simulator::Simulator(uint32_t const seed):
+  m_generator(seed),
+  m_grass(GRID_SIZE * GRID_SIZE, 0.0f),
+  m_time(0),
+  m_battery(1.0f),
+  m_cloud_dir_x(0.0f),
+  m_cloud_dir_y(0.0f),
+  m_cloud_x(0.0f),
+  m_cloud_y(0.0f),
+  m_i(0),
+  m_j(0)
+{
+  Restart(seed);
+}
+
+inline Simulator::~Simulator()
+{
+}
+
+inline float Simulator::GetGrass(int32_t i, int32_t j) const
+{
+  if (IsWall(i, j)) {
+    return OUTSIDE;
+  }
+  return m_grass[j * GRID_SIZE + i];
+}
+
+inline float Simulator::GetRain(int32_t i, int32_t j) const
+{
+  return rainAt(i, j, m_cloud_x, m_cloud_y);
+}
+
+inline Sensors Simulator::GetSensors() const
+{
+  Sensors sensors;
+  sensors.i(m_i);
+  sensors.j(m_j);
+  sensors.time(m_time);
+  sensors.grassTopLeft(GetGrass(m_i - 1, m_j - 1));
+  sensors.grassTopCentre(GetGrass(m_i, m_j - 1));
+  sensors.grassTopRight(GetGrass(m_i + 1, m_j - 1));
+  sensors.grassLeft(GetGrass(m_i - 1, m_j));
+  sensors.grassCentre(GetGrass(m_i, m_j));
+  sensors.grassRight(GetGrass(m_i + 1, m_j));
+  sensors.grassBottomLeft(GetGrass(m_i - 1, m_j + 1));
+  sensors.grassBottomCentre(GetGrass(m_i, m_j + 1));
+  sensors.grassBottomRight(GetGrass(m_i + 1, m_j + 1));
+  sensors.rain(GetRain(m_i, m_j));
+  sensors.battery(m_battery);
+  sensors.rainCloudDirX(m_cloud_dir_x);
+  sensors.rainCloudDirY(m_cloud_dir_y);
+  return sensors;
+}
+
+inline Status Simulator::GetStatus() const
+{
+  float grassMax{0.0f};
+  double grassSum{0.0};
+  uint32_t cellCount{0};
+  for (int32_t j{0}; j < static_cast<int32_t>(GRID_SIZE); j++) {
+    for (int32_t i{0}; i < static_cast<int32_t>(GRID_SIZE); i++) {
+      if (IsWall(i, j)) {
+        continue;
+      }
+      float const grass = m_grass[j * GRID_SIZE + i];
+      grassMax = std::max(grassMax, grass);
+      grassSum += grass;
+      cellCount++;
+    }
+  }
+
+  Status status;
+  status.time(m_time);
+  status.grassMax(grassMax);
+  status.grassMean(static_cast<float>(grassSum / cellCount));
+  return status;
+}
+
+inline uint64_t Simulator::GetTime() const
+{
+  return m_time;
+}
+
+inline bool Simulator::IsWall(int32_t i, int32_t j) const
+{
+  return isWall(i, j);
+}
+
+inline void Simulator::MoveRainCloud()
+{
+  m_cloud_x += CLOUD_SPEED * m_cloud_dir_x;
+  m_cloud_y += CLOUD_SPEED * m_cloud_dir_y;
+
+  float const limit = static_cast<float>(GRID_SIZE) + CLOUD_RADIUS;
+  if (m_cloud_x < -CLOUD_RADIUS || m_cloud_x > limit
+      || m_cloud_y < -CLOUD_RADIUS || m_cloud_y > limit) {
+    SpawnRainCloud();
+  }
+}
+
+inline void Simulator::Restart(uint32_t const seed)
+{
+  m_generator.seed(seed);
+  std::uniform_real_distribution<float> grass_distribution(0.0f,
+      GRASS_INITIAL_MAX);
+  for (auto &grass : m_grass) {
+    grass = grass_distribution(m_generator);
+  }
+  m_time = 0;
+  m_battery = 1.0f;
+  m_i = 0;
+  m_j = 0;
+  SpawnRainCloud();
+}
+
+inline void Simulator::Restart(tme290::grass::Restart const &restart)
+{
+  Restart(restart.seed());
+}
+
+inline void Simulator::SpawnRainCloud()
+{
+  spawnRainCloud(m_generator, m_cloud_x, m_cloud_y, m_cloud_dir_x,
+      m_cloud_dir_y);
+}
+
+inline Sensors Simulator::Step(Control const &control)
+{
+  uint8_t const command = (control.command() < 9) ? control.command() : 0;
+  if (m_battery > 0.0f) {
+    int32_t const i = m_i + MOVE_DI[command];
+    int32_t const j = m_j + MOVE_DJ[command];
+    if (!IsWall(i, j)) {
+      m_i = i;
+      m_j = j;
+    }
+    m_battery -= (command == 0) ? BATTERY_DRAIN_STAY : BATTERY_DRAIN_MOVE;
+
+    float const rain = GetRain(m_i, m_j);
+    float &grass = m_grass[m_j * GRID_SIZE + m_i];
+    grass = std::max(0.0f, grass - GRASS_CUT * (1.0f - 0.5f * rain));
+  }
+
+  if (m_i == 0 && m_j == 0) {
+    m_battery = std::min(1.0f, m_battery + BATTERY_CHARGE);
+  }
+  m_battery = std::max(0.0f, m_battery);
+
+  for (int32_t j{0}; j < static_cast<int32_t>(GRID_SIZE); j++) {
+    for (int32_t i{0}; i < static_cast<int32_t>(GRID_SIZE); i++) {
+      float &grass = m_grass[j * GRID_SIZE + i];
+      grass = std::min(1.0f, grass + GRASS_GROWTH
+          + GRASS_GROWTH_RAIN * GetRain(i, j));
+    }
+  }
+
+  MoveRainCloud();
+  m_time++;
+
+  return GetSensors();
+}
+
+}
+}
+
+#endif